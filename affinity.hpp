@@ -0,0 +1,140 @@
+#pragma once
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <set>
+#include "debug_logger.hpp"
+
+// CPU 绑核 / NUMA 相关的小工具，全部基于 sysfs 和 pthread，不依赖 libnuma
+class Affinity {
+public:
+    // 解析 "0-3,8,10-11" 这种 cpulist 格式
+    static std::vector<int> parseCpuList(const std::string& list) {
+        std::vector<int> cpus;
+        std::stringstream ss(list);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            if (item.empty()) continue;
+            try {
+                auto dash = item.find('-');
+                if (dash == std::string::npos) {
+                    cpus.push_back(std::stoi(item));
+                } else {
+                    int lo = std::stoi(item.substr(0, dash));
+                    int hi = std::stoi(item.substr(dash + 1));
+                    for (int c = lo; c <= hi; c++) cpus.push_back(c);
+                }
+            } catch (const std::exception&) {
+                LOG_WARN("Affinity bad cpu list item: ", item);
+            }
+        }
+        return cpus;
+    }
+
+    static std::string toCpuList(const std::vector<int>& cpus) {
+        std::string out;
+        for (std::size_t i = 0; i < cpus.size(); i++) {
+            if (i) out += ",";
+            out += std::to_string(cpus[i]);
+        }
+        return out;
+    }
+
+    // cpu 所在的 NUMA 节点，单节点机器或读不到 sysfs 时返回 0
+    static int cpuNode(int cpu) {
+        DIR* dir = opendir("/sys/devices/system/node");
+        if (!dir) return 0;
+        int node = 0;
+        while (dirent* ent = readdir(dir)) {
+            std::string name = ent->d_name;
+            if (name.compare(0, 4, "node") != 0 || name.size() == 4) continue;
+            std::ifstream ifs("/sys/devices/system/node/" + name + "/cpulist");
+            std::string list;
+            if (!(ifs >> list)) continue;
+            for (int c : parseCpuList(list)) {
+                if (c == cpu) {
+                    node = std::atoi(name.c_str() + 4);
+                    closedir(dir);
+                    return node;
+                }
+            }
+        }
+        closedir(dir);
+        return node;
+    }
+
+    static std::set<int> cpuNodes(const std::vector<int>& cpus) {
+        std::set<int> nodes;
+        for (int c : cpus) nodes.insert(cpuNode(c));
+        return nodes;
+    }
+
+    // 把当前线程绑到单个 cpu 上
+    // 要在线程刚启动、还没分配内存前调用，这样线程栈和 thread_local 缓冲区
+    // 按 first-touch 策略会落在本地 NUMA 节点
+    static bool pinCurrentThread(int cpu) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (ret != 0) {
+            LOG_WARN("Affinity pin to cpu ", cpu, " failed, errno=", ret);
+            return false;
+        }
+        return true;
+    }
+
+    // 进程启动时的 cpu 集合，第一次调用时记录，必须在任何线程绑核之前调用一次
+    static const cpu_set_t& processMask() {
+        static const cpu_set_t mask = [] {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            sched_getaffinity(0, sizeof(set), &set);
+            return set;
+        }();
+        return mask;
+    }
+
+    // 新线程继承创建者的绑核，不需要绑核的线程用它恢复成进程原本的 cpu 集合
+    static bool unpinCurrentThread() {
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &processMask());
+        if (ret != 0) {
+            LOG_WARN("Affinity unpin failed, errno=", ret);
+            return false;
+        }
+        return true;
+    }
+
+    // 查 /proc/interrupts 里名字包含 nic 的中断号（如 eth0-TxRx-0）
+    static std::vector<int> nicIrqs(const std::string& nic) {
+        std::vector<int> irqs;
+        std::ifstream ifs("/proc/interrupts");
+        std::string line;
+        while (std::getline(ifs, line)) {
+            if (line.find(nic) == std::string::npos) continue;
+            auto colon = line.find(':');
+            if (colon == std::string::npos) continue;
+            try {
+                irqs.push_back(std::stoi(line.substr(0, colon)));
+            } catch (const std::exception&) {
+                // 非数字的行（NMI、LOC 等）跳过
+            }
+        }
+        return irqs;
+    }
+
+    // 把中断亲和性设到指定 cpu，需要 root
+    static bool bindIrq(int irq, int cpu) {
+        std::ofstream ofs("/proc/irq/" + std::to_string(irq) + "/smp_affinity_list");
+        if (!ofs || !(ofs << cpu << std::endl)) {
+            LOG_WARN("Affinity bind irq ", irq, " to cpu ", cpu, " failed");
+            return false;
+        }
+        LOG_INFO("Affinity irq ", irq, " -> cpu ", cpu);
+        return true;
+    }
+};
@@ -1,9 +1,11 @@
+#pragma once
 #include<mysql/mysql.h>
 #include "debug_logger.hpp"
 #include <vector>
 #include <string>
 #include <iostream>
 #include <mutex>
+#include <stdexcept>
 class MySqlDB{
     private:
         MYSQL *conn;
@@ -46,6 +48,14 @@ class MySqlDB{
             return true;
         }
 
+        // 拼接 SQL 字符串前对用户输入转义
+        std::string escape(const std::string& s){
+            std::string out(s.size() * 2 + 1, '\0');
+            unsigned long n = mysql_real_escape_string(conn, &out[0], s.c_str(), s.size());
+            out.resize(n);
+            return out;
+        }
+
         auto query(const std::string& sql){
             LOG_DEBUG("mysql query: %s",sql.c_str());
             std::lock_guard<std::mutex> lock(mu);
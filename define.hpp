@@ -14,11 +14,56 @@
 
 #define NUM_WORKERS 8
 
+// 线程池通道
+#define DEFAULT_LANE "default"
+#define NET_LANE "net"          // 网络分发，延迟敏感
+#define DB_LANE "db"            // 数据库等阻塞任务
+#define DB_WORKERS 2
+#define DB_MAX_WORKERS 8        // db 通道积压时最多扩到的线程数
+#define LANE_IDLE_MS 5000       // 弹性线程空闲多久后退出
+
+// 绑核配置，cpulist 格式（如 "2-7"），空串表示交给系统调度
+#define NET_CPUS ""
+#define DB_CPUS ""
+#define REACTOR_CPU -1          // epoll 线程绑定的 cpu，-1 不绑
+#define REACTOR_NIC ""          // 非空时把该网卡的中断也绑到 REACTOR_CPU（需要 root）
+
 #define SQL_IP "1.94.121.19"
 
 #define SQL_USER "reuser"
 #define SQL_PASSWD "12345678"
 #define SQL_DB "chatroom"
 #define EPOLL_MAX_EVENTS 1024
+#define CONN_OUTBUF_BYTES (1 << 20)     // 单个连接积压的待发送字节上限，超过就丢弃新消息
+#define MAX_MSG_BYTES 4096              // 单条消息的字节上限
+#define TRUST_UID_LOGIN 0               // 1 时允许 /login <uid> 免密登录，只用于本地调试
+#define PASSWORD_HASH_ITERATIONS 10000  // 新密码的 PBKDF2 轮数，旧记录按各自存的轮数校验
+
+// 房间
+#define LOBBY_ROOM 0                    // 新连接默认进入的房间
+#define MAX_ROOMS 256                   // 房间号范围 [0, MAX_ROOMS)，会话表里按位图记录
+#define PRESENCE_TICK_MS 200            // 上下线通知的聚合窗口
+#define ROOM_HISTORY_MSGS 1024          // 每个房间内存中保留的消息条数
+#define ROOM_HISTORY_BYTES (1 << 20)    // 每个房间内存中保留的消息字节数
+
+// 离线消息日志
+#define MSG_LOG_DIR "msglog"
+#define MSG_LOG_SEGMENT_BYTES (64 << 20)   // 单个分段文件大小
+#define MSG_LOG_SYNC_RECORDS 64            // 攒够多少条 msync 一次
+#define MSG_LOG_SYNC_MS 10                 // 或者距上次 msync 超过多少毫秒
+
+// 用户缓存
+#define USER_CACHE_CAPACITY 100000
+#define USER_CACHE_SHARDS 16
+#define USER_CACHE_TTL_S 0                  // 0 表示不过期，只靠更新时失效
+
+// 集群
+#define CLUSTER_VNODES 64                   // 每个节点在哈希环上的虚拟节点数
+#define CLUSTER_BATCH_MS 5                  // 节点间帧的最长攒批时间
+#define CLUSTER_BATCH_BYTES (64 << 10)      // 攒够这么多字节立即发送
+#define CLUSTER_OUTBOX_BYTES (4 << 20)     // 发往单个节点的待发帧上限，对端不可达时超出的帧丢弃
+#define CLUSTER_CONNECT_TIMEOUT_MS 1000     // 节点间建连超时
+#define CLUSTER_RECONNECT_MIN_MS 50         // 建连失败后的重试间隔，每次翻倍
+#define CLUSTER_RECONNECT_MAX_MS 5000       // 重试间隔上限
 
 
@@ -0,0 +1,82 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "define.hpp"
+
+// 消息体在广播、历史记录、重放之间共享，不再逐个接收者拷贝
+using Payload = std::shared_ptr<const std::string>;
+
+// 房间最近 N 条消息的环形缓冲，同时受条数和字节数限制
+// 读写都在房间锁里进行；first_seq/next_seq 用原子量只是为了让 resume 在锁外先看一眼
+class RoomHistory {
+    std::vector<Payload> slots;             // 空槽为 nullptr
+    std::size_t mask;
+    std::size_t max_bytes;
+    std::size_t bytes = 0;
+    std::atomic<uint64_t> first_seq{1};     // 最老的未淘汰序号
+    std::atomic<uint64_t> next_seq{1};      // 下一条消息的序号
+
+    void evictOldest() {
+        uint64_t s = first_seq.load(std::memory_order_relaxed);
+        Payload& slot = slots[s & mask];
+        if (slot) bytes -= slot->size();
+        slot.reset();
+        first_seq.store(s + 1, std::memory_order_release);
+    }
+
+public:
+    explicit RoomHistory(std::size_t capacity = ROOM_HISTORY_MSGS, std::size_t max_bytes = ROOM_HISTORY_BYTES)
+        : max_bytes(max_bytes) {
+        std::size_t n = 1;
+        while (n < capacity) n <<= 1;
+        slots = std::vector<Payload>(n);
+        mask = n - 1;
+    }
+
+    RoomHistory(const RoomHistory&) = delete;
+    RoomHistory& operator=(const RoomHistory&) = delete;
+
+    // 只能由持有房间锁的线程调用，返回分配到的序号
+    uint64_t append(const Payload& payload) {
+        uint64_t s = next_seq.load(std::memory_order_relaxed);
+        while (s - first_seq.load(std::memory_order_relaxed) >= slots.size()) evictOldest();
+        bytes += payload->size();
+        while (bytes > max_bytes && first_seq.load(std::memory_order_relaxed) < s) evictOldest();
+
+        slots[s & mask] = payload;
+        next_seq.store(s + 1, std::memory_order_release);
+        return s;
+    }
+
+    // 下一条消息会拿到的序号，写端在 append 前用来拼消息头
+    uint64_t nextSeq() const { return next_seq.load(std::memory_order_acquire); }
+    uint64_t lastSeq() const { return next_seq.load(std::memory_order_acquire) - 1; }
+    uint64_t firstSeq() const { return first_seq.load(std::memory_order_acquire); }
+
+    // 取出序号大于 after 的消息，返回 false 表示中间有一段已经被淘汰，
+    // 此时 out 里是内存中还剩下的部分，*missing_to 是缺口的最后一个序号
+    // 直接从 max(after+1, firstSeq()) 开始，已淘汰的部分不逐条扫；调用方持有房间锁
+    bool since(uint64_t after, std::vector<Payload>& out, uint64_t* missing_to = nullptr) const {
+        uint64_t first = firstSeq();
+        uint64_t last = lastSeq();
+        bool complete = after + 1 >= first;
+        if (!complete && missing_to) *missing_to = first - 1;
+        for (uint64_t s = std::max(after + 1, first); s <= last; s++) out.push_back(slots[s & mask]);
+        return complete;
+    }
+};
+
+class Room {
+public:
+    int id;
+    std::mutex mu;            // 串行化本房间的写入和成员变化
+    std::set<int> members;    // 成员的会话槽位
+    RoomHistory history;
+
+    explicit Room(int rid) : id(rid) {}
+};
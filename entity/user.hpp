@@ -1,20 +1,21 @@
+#pragma once
 #include <chrono>
 #include <string>
+#include <vector>
+#include <memory>
 
 enum class Gender{ Male,Female,Unkonw};
 
+// 用户资料（冷数据）。在线状态、连接、所在房间这些热状态在 SessionTable 里
 class User{
 
     public:
         int id;
         std::string name;
         std::string password_hash;
-        std::string cur_ip;
-        int sock_fd=-1;
-        bool is_online;
 
-        int age;
-        Gender gender;
+        int age=0;
+        Gender gender=Gender::Unkonw;
         std::string email;
         
         std::chrono::system_clock::time_point created_at;
@@ -30,9 +31,11 @@ class User{
 
         User& setGender(Gender g) { gender = g; return *this; }
 
-        User& setIp(const std::string& ip) { cur_ip = ip; return *this; }
-
-        User& setOnline(bool o) { is_online = o; return *this; }
-
-        User& setSockFd(int fd) { sock_fd = fd; return *this; }
-};
\ No newline at end of file
+        // 数据库行 -> User，列顺序：id, name, password_hash, email
+        static std::shared_ptr<User> fromRow(const std::vector<std::string>& row) {
+            if (row.size() < 3) return nullptr;
+            auto u = std::make_shared<User>(std::stoi(row[0]), row[1], row[2]);
+            if (row.size() > 3 && row[3] != "NULL") u->setEmail(row[3]);
+            return u;
+        }
+};
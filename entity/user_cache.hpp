@@ -0,0 +1,297 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "entity/user.hpp"
+#include "debug_logger.hpp"
+#include "define.hpp"
+
+// 挡在 MySQL 前面的 User 读穿缓存
+// 按 id 分片，每个分片一把锁 + 一条 LRU 链；按名字查找走单独分片的 名字->id 索引。
+// 同一个 key 的并发未命中只会触发一次数据库查询（single-flight）。
+class UserCache {
+public:
+    using UserPtr = std::shared_ptr<const User>;
+    using IdLoader = std::function<UserPtr(int)>;
+    using NameLoader = std::function<UserPtr(const std::string&)>;
+
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t coalesced;     // 搭了别人查询便车的未命中
+        uint64_t loads;
+        uint64_t evictions;
+        uint64_t invalidations;
+    };
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        UserPtr user;
+        Clock::time_point expires;
+    };
+
+    struct Shard {
+        std::mutex mu;
+        std::list<Entry> lru;   // 头部是最近使用的
+        std::unordered_map<int, std::list<Entry>::iterator> by_id;
+        std::unordered_map<int, std::shared_future<UserPtr>> inflight;
+        uint64_t epoch = 0;     // 每次失效 +1，加载回来发现变了就不回填
+    };
+
+    struct NameLoad {
+        std::shared_future<UserPtr> result;
+        uint64_t generation;    // 开始加载时的全局失效代数，之后有失效的话不再让新请求搭便车
+    };
+
+    struct NameShard {
+        std::mutex mu;
+        std::unordered_map<std::string, int> ids;
+        std::unordered_map<std::string, NameLoad> inflight;
+    };
+
+    IdLoader load_by_id;
+    NameLoader load_by_name;
+    std::size_t shard_capacity;
+    std::chrono::seconds ttl;   // 0 表示不过期
+    std::vector<Shard> shards;
+    std::vector<NameShard> name_shards;
+
+    std::atomic<uint64_t> hits{0}, misses{0}, coalesced{0}, loads{0}, evictions{0}, invalidations{0};
+    // 按名字加载前不知道 id，没法记分片代数，改看全局失效代数；invalidate 在分片锁内递增
+    std::atomic<uint64_t> generation{0};
+
+    Shard& shardOf(int id) { return shards[(unsigned)id % shards.size()]; }
+    NameShard& shardOf(const std::string& name) { return name_shards[std::hash<std::string>()(name) % name_shards.size()]; }
+
+    // 在分片锁内查找，命中时移到 LRU 头部
+    UserPtr lookupLocked(Shard& shard, int id) {
+        auto it = shard.by_id.find(id);
+        if (it == shard.by_id.end()) return nullptr;
+        if (ttl.count() > 0 && Clock::now() >= it->second->expires) {
+            shard.lru.erase(it->second);
+            shard.by_id.erase(it);
+            return nullptr;
+        }
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return it->second->user;
+    }
+
+    // 按 id 加载时传加载前的分片代数，按名字加载时传加载前的全局代数（by_name 为真）
+    // 返回 false 表示加载期间被失效过，结果可能是旧的，没有放入缓存
+    bool insert(const UserPtr& user, uint64_t epoch, bool by_name = false) {
+        Shard& shard = shardOf(user->id);
+        std::vector<std::string> evicted_names;
+        {
+            std::lock_guard<std::mutex> lock(shard.mu);
+            if ((by_name ? generation.load() : shard.epoch) != epoch) return false;
+            auto it = shard.by_id.find(user->id);
+            if (it != shard.by_id.end()) {
+                shard.lru.erase(it->second);
+                shard.by_id.erase(it);
+            }
+            shard.lru.push_front({user, Clock::now() + ttl});
+            shard.by_id[user->id] = shard.lru.begin();
+            while (shard.lru.size() > shard_capacity) {
+                evicted_names.push_back(shard.lru.back().user->name);
+                shard.by_id.erase(shard.lru.back().user->id);
+                shard.lru.pop_back();
+                evictions++;
+            }
+        }
+        {
+            NameShard& ns = shardOf(user->name);
+            std::lock_guard<std::mutex> lock(ns.mu);
+            ns.ids[user->name] = user->id;
+        }
+        for (auto& name : evicted_names) {
+            NameShard& ns = shardOf(name);
+            std::lock_guard<std::mutex> lock(ns.mu);
+            ns.ids.erase(name);
+        }
+        return true;
+    }
+
+public:
+    UserCache(IdLoader by_id, NameLoader by_name,
+              std::size_t capacity = USER_CACHE_CAPACITY,
+              int num_shards = USER_CACHE_SHARDS,
+              int ttl_seconds = USER_CACHE_TTL_S)
+        : load_by_id(std::move(by_id)), load_by_name(std::move(by_name)),
+          shard_capacity(std::max<std::size_t>(1, capacity / num_shards)),
+          ttl(ttl_seconds), shards(num_shards), name_shards(num_shards) {
+        LOG_INFO("UserCache created, capacity=", capacity, " shards=", num_shards, " ttl=", ttl_seconds);
+    }
+
+    UserCache(const UserCache&) = delete;
+    UserCache& operator=(const UserCache&) = delete;
+
+    // 只查内存，不触发数据库，给网络线程上的快路径用
+    UserPtr peek(int id) {
+        Shard& shard = shardOf(id);
+        std::lock_guard<std::mutex> lock(shard.mu);
+        UserPtr u = lookupLocked(shard, id);
+        if (u) hits++;
+        return u;
+    }
+
+    UserPtr peekByName(const std::string& name) {
+        int id;
+        {
+            NameShard& ns = shardOf(name);
+            std::lock_guard<std::mutex> lock(ns.mu);
+            auto it = ns.ids.find(name);
+            if (it == ns.ids.end()) return nullptr;
+            id = it->second;
+        }
+        UserPtr u = peek(id);
+        return (u && u->name == name) ? u : nullptr;
+    }
+
+    // 未命中时同步加载，会阻塞，应在 db 通道上调用
+    UserPtr get(int id) {
+        Shard& shard = shardOf(id);
+        std::promise<UserPtr> promise;
+        std::shared_future<UserPtr> wait_on;
+        uint64_t epoch;
+        {
+            std::lock_guard<std::mutex> lock(shard.mu);
+            if (UserPtr u = lookupLocked(shard, id)) {
+                hits++;
+                return u;
+            }
+            misses++;
+            auto it = shard.inflight.find(id);
+            if (it != shard.inflight.end()) {
+                coalesced++;
+                wait_on = it->second;
+            } else {
+                shard.inflight[id] = promise.get_future().share();
+            }
+            epoch = shard.epoch;
+        }
+        if (wait_on.valid()) return wait_on.get();
+
+        UserPtr u;
+        try {
+            loads++;
+            u = load_by_id(id);
+            if (u) insert(u, epoch);
+        } catch (...) {
+            finishInflight(shard, id, epoch);
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+        finishInflight(shard, id, epoch);
+        promise.set_value(u);
+        return u;
+    }
+
+    UserPtr getByName(const std::string& name) {
+        if (UserPtr u = peekByName(name)) return u;
+        NameShard& ns = shardOf(name);
+        std::promise<UserPtr> promise;
+        std::shared_future<UserPtr> wait_on;
+        uint64_t gen = generation.load();
+        {
+            std::lock_guard<std::mutex> lock(ns.mu);
+            misses++;
+            auto it = ns.inflight.find(name);
+            if (it != ns.inflight.end() && it->second.generation == gen) {
+                coalesced++;
+                wait_on = it->second.result;
+            } else {
+                ns.inflight[name] = {promise.get_future().share(), gen};
+            }
+        }
+        if (wait_on.valid()) return wait_on.get();
+
+        UserPtr u;
+        try {
+            // 加载期间有失效（比如改了密码），结果可能是旧的，重新加载，最多 3 次
+            uint64_t load_gen = gen;
+            for (int attempt = 0; attempt < 3; attempt++) {
+                loads++;
+                u = load_by_name(name);
+                if (!u || insert(u, load_gen, true)) break;
+                load_gen = generation.load();
+            }
+        } catch (...) {
+            finishInflight(ns, name, gen);
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+        finishInflight(ns, name, gen);
+        promise.set_value(u);
+        return u;
+    }
+
+    // 用户资料更新后调用，下次访问重新从数据库加载
+    void invalidate(int id) {
+        std::string name;
+        {
+            Shard& shard = shardOf(id);
+            std::lock_guard<std::mutex> lock(shard.mu);
+            shard.epoch++;
+            generation++;
+            shard.inflight.erase(id);
+            auto it = shard.by_id.find(id);
+            if (it != shard.by_id.end()) {
+                name = it->second->user->name;
+                shard.lru.erase(it->second);
+                shard.by_id.erase(it);
+            }
+        }
+        if (!name.empty()) {
+            NameShard& ns = shardOf(name);
+            std::lock_guard<std::mutex> lock(ns.mu);
+            ns.ids.erase(name);
+        }
+        invalidations++;
+    }
+
+    // 写库成功后直接放入新值，省一次回源
+    void put(const UserPtr& user) {
+        invalidate(user->id);
+        Shard& shard = shardOf(user->id);
+        uint64_t epoch;
+        {
+            std::lock_guard<std::mutex> lock(shard.mu);
+            epoch = shard.epoch;
+        }
+        insert(user, epoch);
+    }
+
+    Stats stats() const {
+        return Stats{hits.load(), misses.load(), coalesced.load(), loads.load(), evictions.load(), invalidations.load()};
+    }
+
+    void logStats() const {
+        auto s = stats();
+        LOG_INFO("UserCache hits=", s.hits, " misses=", s.misses, " coalesced=", s.coalesced,
+                 " loads=", s.loads, " evictions=", s.evictions, " invalidations=", s.invalidations);
+    }
+
+private:
+    // epoch 变了说明 invalidate 已经清掉了这条，可能已有新的加载在进行，不能误删
+    void finishInflight(Shard& shard, int id, uint64_t epoch) {
+        std::lock_guard<std::mutex> lock(shard.mu);
+        if (shard.epoch == epoch) shard.inflight.erase(id);
+    }
+
+    // 失效后可能已有更新的加载占了这个名字，只删自己的
+    void finishInflight(NameShard& ns, const std::string& name, uint64_t gen) {
+        std::lock_guard<std::mutex> lock(ns.mu);
+        auto it = ns.inflight.find(name);
+        if (it != ns.inflight.end() && it->second.generation == gen) ns.inflight.erase(it);
+    }
+};
@@ -2,29 +2,47 @@
 
 #include "db_op.hpp"
 #include "thread.hpp"
+#include "entity/user_cache.hpp"
 int main(){
      try {
         // 连接数据库
         MySqlDB db(SQL_IP, SQL_USER, SQL_PASSWD, SQL_DB);
 
-        // 创建一个线程池
+        // 创建一个线程池，数据库任务单独走 db 通道
         ThreadPool pool(4);
+        pool.addLane(DB_LANE, DB_WORKERS, DB_MAX_WORKERS);
         pool.init();
 
         // 提交写任务
-        pool.submit([&db]() {
+        pool.submit(DB_LANE, [&db]() {
             db.exec("INSERT INTO test(id, name) VALUES(11, 'test')");
         });
 
         // 提交读任务
-        pool.submit([&db]() {
+        pool.submit(DB_LANE, [&db]() {
             auto rows = db.query("SELECT id, name FROM test");
             for (auto& r : rows) {
                 std::cout << "id=" << r[0] << " name=" << r[1] << std::endl;
             }
         });
 
+        // 用户缓存，未命中时回源数据库
+        UserCache users(
+            [&db](int id) -> UserCache::UserPtr {
+                auto rows = db.query("SELECT id, name, password_hash, email FROM user WHERE id = " + std::to_string(id));
+                return rows.empty() ? nullptr : User::fromRow(rows[0]);
+            },
+            [&db](const std::string& name) -> UserCache::UserPtr {
+                auto rows = db.query("SELECT id, name, password_hash, email FROM user WHERE name = '" + db.escape(name) + "'");
+                return rows.empty() ? nullptr : User::fromRow(rows[0]);
+            });
+        pool.submit(DB_LANE, [&users]() {
+            if (auto u = users.get(1)) std::cout << "user 1: " << u->name << std::endl;
+        });
+
         pool.shutdown(); // 等待所有任务完成
+        users.logStats();
+        pool.logStats();
     } catch (const std::exception& e) {
         std::cerr << "Exception: " << e.what() << std::endl;
     }
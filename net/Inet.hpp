@@ -1,3 +1,4 @@
+#pragma once
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -10,8 +11,19 @@
 #include <fcntl.h>
 #include <vector>
 #include <string>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <debug_logger.hpp>
 #include "thread.hpp"
+#include "entity/room.hpp"
+#include "store/msg_log.hpp"
+#include "entity/user_cache.hpp"
+#include "net/session.hpp"
+#include "net/presence.hpp"
+#include "net/utf8.hpp"
+#include "password.hpp"
 
 // 抽象类
 class INetConn{
@@ -25,20 +37,72 @@ class INetConn{
 
 class TcpConn: public INetConn{ 
         int sock_fd;
+        // 非阻塞 socket 写满时没写出去的部分，EPOLLOUT 时续写；有积压时新消息排在后面，保证帧不交错
+        std::mutex write_mu;
+        std::string outbuf;
+        std::atomic<bool> backlog{false};
+        // 读到的、还没处理的数据（比如被截断的多字节字符），同一连接的读处理用 read_mu 串行化
+        std::mutex read_mu;
+        std::string inbuf;
     public:
         explicit TcpConn(int fd):sock_fd(fd){}
         ~TcpConn(){if (sock_fd > 0) close(sock_fd);}
 
         bool send(const std::string& data) override{
-            int ret = ::send(sock_fd, data.c_str(), data.size(), 0);
+            std::lock_guard<std::mutex> lock(write_mu);
+            return sendLocked(data);
+        }
+
+        // 直接往 fd 写的调用方（离线日志投递）先拿这把锁，并确认没有积压
+        std::mutex& writeMutex() { return write_mu; }
+        bool backlogLocked() const { return !outbuf.empty(); }
+        bool backlogged() const { return backlog; }
+
+        // 持有 writeMutex() 时调用
+        bool sendLocked(const std::string& data) {
+            if (!outbuf.empty()) {
+                if (outbuf.size() + data.size() > CONN_OUTBUF_BYTES) {
+                    LOG_WARN("Tcp conn ", sock_fd, " output backlog full, drop ", data.size(), " bytes");
+                    return false;
+                }
+                outbuf += data;
+                return true;
+            }
+            // 对端已关闭时返回错误而不是触发 SIGPIPE
+            ssize_t ret = ::send(sock_fd, data.c_str(), data.size(), MSG_NOSIGNAL);
             if (ret < 0) {
-                std::cout << "send error" << std::endl;
-                LOG_ERROR("Tcp send error");
-                return false;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    std::cout << "send error" << std::endl;
+                    LOG_ERROR("Tcp send error");
+                    return false;
+                }
+                ret = 0;
+            }
+            if ((std::size_t)ret < data.size()) {
+                outbuf.assign(data, ret, std::string::npos);
+                backlog = true;
             }
             return true;
         }
 
+        // EPOLLOUT 时调用，返回积压是否已经写完
+        bool flush() {
+            std::lock_guard<std::mutex> lock(write_mu);
+            while (!outbuf.empty()) {
+                ssize_t ret = ::send(sock_fd, outbuf.data(), outbuf.size(), MSG_NOSIGNAL);
+                if (ret < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) return false;
+                    LOG_ERROR("Tcp flush error on ", sock_fd);
+                    outbuf.clear();
+                    backlog = false;
+                    return false;
+                }
+                outbuf.erase(0, ret);
+            }
+            backlog = false;
+            return true;
+        }
+
         std::string recv() override{
             char buf[1024] = {0};
             int ret = ::recv(sock_fd, buf, sizeof(buf), 0);
@@ -54,6 +118,28 @@ class TcpConn: public INetConn{
             return sock_fd;
         }
 
+        std::mutex& readMutex() { return read_mu; }
+        std::string& inputLocked() { return inbuf; }
+
+        // 边缘触发：一直读到 EAGAIN，接在 inbuf 后面；超过 cap 的部分丢掉并置 overflow
+        // 返回 false 表示对端关闭或出错
+        bool readAvailableLocked(std::size_t cap, bool& overflow) {
+            char buf[4096];
+            for (;;) {
+                ssize_t ret = ::recv(sock_fd, buf, sizeof(buf), 0);
+                if (ret > 0) {
+                    if (inbuf.size() + ret > cap) overflow = true;
+                    else inbuf.append(buf, ret);
+                    continue;
+                }
+                if (ret == 0) return false;
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+                LOG_ERROR("Tcp recv error on ", sock_fd);
+                return false;
+            }
+        }
+
 };
 
 
@@ -69,10 +155,75 @@ class TcpServer : public INetServer {
     bool running;
     int epfd;
     ThreadPool pool;
-    std::unordered_map<int,std::unique_ptr<TcpConn>> clients;
+    SessionTable<TcpConn> sessions;
+    PresenceAggregator presence;
+    std::chrono::steady_clock::time_point next_presence_tick;
+    std::mutex rooms_mu;
+    std::unordered_map<int,std::unique_ptr<Room>> rooms;
+    // 内存里的历史已被淘汰时，从数据库补 [from, to] 这一段
+    std::function<std::vector<std::string>(int room, uint64_t from, uint64_t to)> history_loader;
+    // 串行化登录和离线日志的追加，保证上线和离线投递不会互相漏消息
+    std::mutex users_mu;
+    std::unique_ptr<MessageLog> offline_log;
+    // 正在投递离线消息的会话，socket 写满后等 EPOLLOUT 接着投
+    struct OfflineDelivery {
+        SessionRef ref;
+        int uid = -1;
+        uint64_t inflight = 0;  // 尾部已交给输出缓冲、还没确认的记录
+        bool running = false;
+        bool again = false;     // 运行期间又有了新的可写事件或重新登录
+    };
+    std::mutex delivery_mu;
+    std::unordered_map<int, OfflineDelivery> deliveries;    // 槽位 -> 投递进度
+    UserCache* user_cache = nullptr;
+    // 集群钩子：房间在本节点有无成员的变化，以及本地产生的房间消息（不含 "#seq " 前缀）
+    std::function<void(int room, bool active)> on_room_active;
+    std::function<void(int room, const std::string& body)> on_room_message;
+    int reactor_cpu = REACTOR_CPU;
+    std::string reactor_nic = REACTOR_NIC;
 
 public:
-    TcpServer() : listen_fd(-1), running(false) {}
+    // 网络分发走 net 通道，数据库等阻塞任务走 db 通道，互不抢线程
+    TcpServer() : listen_fd(-1), running(false), epfd(-1), pool(NUM_WORKERS, NET_LANE) {
+        pool.addLane(DB_LANE, DB_WORKERS, DB_MAX_WORKERS);
+        if (std::string(NET_CPUS).size()) pool.setLaneCpus(NET_LANE, Affinity::parseCpuList(NET_CPUS));
+        if (std::string(DB_CPUS).size()) pool.setLaneCpus(DB_LANE, Affinity::parseCpuList(DB_CPUS));
+    }
+
+    // epoll 线程绑核；nic 非空时把网卡中断也放到同一个核，软中断和 epoll 共享缓存
+    void setReactorCpu(int cpu, const std::string& nic = "") {
+        reactor_cpu = cpu;
+        reactor_nic = nic;
+    }
+
+    ThreadPool& executor() { return pool; }
+
+    // /login 需要 用户名 + 密码，用户资料从缓存取，未命中才回源；不设置时只能用调试用的免密登录
+    void setUserCache(UserCache* cache) { user_cache = cache; }
+
+    // 在 db 通道上执行，返回的每条都应是完整的一帧（含 "#seq " 前缀）
+    void setHistoryLoader(std::function<std::vector<std::string>(int, uint64_t, uint64_t)> loader) {
+        history_loader = std::move(loader);
+    }
+
+    void setClusterHooks(std::function<void(int, bool)> room_active,
+                         std::function<void(int, const std::string&)> room_message) {
+        on_room_active = std::move(room_active);
+        on_room_message = std::move(room_message);
+    }
+
+    // 其他节点转发来的房间消息，按本地序号记入历史并发给本地成员
+    void deliverRemote(int room_id, const std::string& body) {
+        pool.submit(NET_LANE, [this, room_id, body]() {
+            Room& room = getRoom(room_id);
+            std::lock_guard<std::mutex> lock(room.mu);
+            uint64_t seq = room.history.nextSeq();
+            auto payload = std::make_shared<const std::string>("#" + std::to_string(seq) + " " + body);
+            room.history.append(payload);
+            for (auto& conn : sessions.connsOf(room.members)) conn->send(*payload);
+        });
+    }
+
     void setNonblocking(int fd){
         int flags = fcntl(fd, F_GETFL, 0);
         fcntl(fd, F_SETFL, flags | O_NONBLOCK);
@@ -89,59 +240,67 @@ public:
         ::bind(listen_fd, (sockaddr*)&serv, sizeof(serv));
         ::listen(listen_fd, 128);
 
-        epfd = epoll_create(0);
+        epfd = epoll_create1(0);
         epoll_event ev{};
         ev.events = EPOLLIN;
         ev.data.fd = listen_fd;
 
         
         epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+        offline_log = std::make_unique<MessageLog>(MSG_LOG_DIR);
         pool.init();
+        pool.logStats();
+        // 线程都起好之后再给 epoll 线程绑核，否则它们会继承这个单核的 cpu 集合
+        if (reactor_cpu >= 0 && Affinity::pinCurrentThread(reactor_cpu)) {
+            LOG_INFO("TcpServer reactor pinned to cpu ", reactor_cpu, " node ", Affinity::cpuNode(reactor_cpu));
+            if (!reactor_nic.empty()) {
+                for (int irq : Affinity::nicIrqs(reactor_nic)) Affinity::bindIrq(irq, reactor_cpu);
+            }
+        }
+        LOG_INFO("TcpServer text filter kernel: ", TextFilter::kernelName());
         
         running = true;
 
         LOG_DEBUG("TcpServer start on port %d", port);
 
 
+        next_presence_tick = std::chrono::steady_clock::now() + std::chrono::milliseconds(PRESENCE_TICK_MS);
         while (running) {
             epoll_event events[EPOLL_MAX_EVENTS];
-            int nfds = epoll_wait(epfd,events,EPOLL_MAX_EVENTS, -1);
+            int nfds = epoll_wait(epfd,events,EPOLL_MAX_EVENTS, PRESENCE_TICK_MS);
+            auto now = std::chrono::steady_clock::now();
+            if (now >= next_presence_tick) {
+                next_presence_tick = now + std::chrono::milliseconds(PRESENCE_TICK_MS);
+                pool.submit(NET_LANE, [this]() { flushPresence(); });
+            }
             for(int i=0;i<nfds;i++){
                 int fd = events[i].data.fd;
                 // 新客户端
                 if(fd == listen_fd){
-                    // 也可以绑定IP地址，在user里面有这个字段
+                    // 连接状态只放在会话表里，User 只是资料
                     int client_fd = accept(listen_fd,nullptr,nullptr);
                     setNonblocking(client_fd);
-                    clients[client_fd] = std::make_unique<TcpConn>(client_fd);
+                    SessionRef ref = sessions.open(client_fd, std::make_shared<TcpConn>(client_fd));
+                    joinRoom(ref, LOBBY_ROOM, 0, false);
                     epoll_event cli_ev{};
-                    cli_ev.events = EPOLLIN | EPOLLET; //边缘触发
+                    cli_ev.events = EPOLLIN | EPOLLOUT | EPOLLET; //边缘触发，可写事件用来续写积压
                     cli_ev.data.fd = client_fd;
                     LOG_DEBUG("TcpServer accept new client %d", client_fd);
                     epoll_ctl(epfd,EPOLL_CTL_ADD,client_fd,&cli_ev);
                 }
-                else if(events[i].events & EPOLLIN){
-                    pool.submit([this,fd](){
-                        auto it = clients.find(fd);
-                        if(it == clients.end()) {
-                            LOG_ERROR("TcpServer client %d not found", fd);
-                            return;
-                        }
-                        std::string msg = it->second->recv();
-                        if(msg.empty()){
-                            LOG_DEBUG("TcpServer client %d disconnect", fd);
-                            epoll_ctl(epfd,EPOLL_CTL_DEL,fd,nullptr);
-                            clients.erase(it);
-                        }else {
-                            LOG_DEBUG("TcpServer client %d recv %s", fd, msg.c_str());
-                            // 暂时分发给全部
-                            for (auto& [other_fd, conn] : clients) {
-                                if (other_fd != fd) {
-                                    conn->send("User " + std::to_string(fd) + ": " + msg);
-                                }
-                            }
-                        }
-                    });
+                else {
+                    if (events[i].events & EPOLLIN) {
+                        SessionRef ref = sessions.refOfFd(fd);
+                        pool.submit(NET_LANE, [this,ref,fd](){
+                            onReadable(ref, fd);
+                        });
+                    }
+                    // 边缘触发下大多数事件都带着 EPOLLOUT，只有真有东西要写时才派任务
+                    if ((events[i].events & EPOLLOUT) && wantsWrite(fd)) {
+                        pool.submit(NET_LANE, [this,fd](){
+                            onWritable(fd);
+                        });
+                    }
                 }
             }
         }
@@ -154,6 +313,371 @@ public:
         if (listen_fd >= 0) close(listen_fd);
         LOG_DEBUG("TcpServer stop");
     }
+
+private:
+    Room& getRoom(int room_id) {
+        std::lock_guard<std::mutex> lock(rooms_mu);
+        auto& room = rooms[room_id];
+        if (!room) room = std::make_unique<Room>(room_id);
+        return *room;
+    }
+
+    // 先关会话（代数对不上说明已经关过，直接返回），再清房间成员；清完才归还槽位，
+    // 这期间槽位不会被新连接复用。调用方持有连接，fd 还没关
+    void disconnect(SessionRef ref, int fd) {
+        int uid = -1;
+        std::vector<int> rooms;
+        {
+            std::lock_guard<std::mutex> lock(users_mu);
+            if (!sessions.close(ref, &uid, &rooms)) return;
+        }
+        LOG_DEBUG("TcpServer client ", fd, " disconnect");
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+        for (int room_id : rooms) {
+            if (leaveRoom(ref.slot, room_id) && uid >= 0) presence.record(room_id, uid, false);
+        }
+        {
+            std::lock_guard<std::mutex> lock(delivery_mu);
+            auto it = deliveries.find(ref.slot);
+            if (it != deliveries.end() && it->second.ref.gen == ref.gen) deliveries.erase(it);
+        }
+        sessions.release(ref.slot);
+    }
+
+    void onReadable(SessionRef ref, int fd) {
+        int slot = ref.slot;
+        auto conn = sessions.conn(slot);
+        if (!conn || !sessions.alive(ref)) {
+            LOG_ERROR("TcpServer client ", fd, " not found");
+            return;
+        }
+        // 同一连接的读和处理串行，保证消息顺序和跨次读的拼接
+        std::lock_guard<std::mutex> rlock(conn->readMutex());
+        // 排在前面的任务可能已经读到 EOF 把会话关了
+        if (!sessions.alive(ref)) return;
+        bool overflow = false;
+        bool open = conn->readAvailableLocked(MAX_MSG_BYTES, overflow);
+        std::string& in = conn->inputLocked();
+        if (overflow) {
+            LOG_WARN("TcpServer client ", fd, " sent more than ", MAX_MSG_BYTES, " bytes");
+            in.clear();
+            conn->send("/error invalid message\n");
+            if (!open) disconnect(ref, fd);
+            return;
+        }
+        // 末尾被截断的多字节字符留到下一次读再拼上，长度限制作用在拼好的整条消息上
+        std::size_t keep = open ? TextFilter::incompleteTail(in) : 0;
+        std::string msg = in.substr(0, in.size() - keep);
+        in.erase(0, in.size() - keep);
+        if (msg.empty()) {
+            if (!open) disconnect(ref, fd);
+            return;
+        }
+        sessions.touch(slot);
+
+        // 校验 UTF-8、去控制字符、限长，原地一遍完成
+        TextCheck check = TextFilter::scrub(msg, MAX_MSG_BYTES);
+        if (check != TextCheck::Ok) {
+            LOG_WARN("TcpServer client ", fd, " sent invalid text, code ", (int)check);
+            conn->send("/error invalid message\n");
+        } else {
+            handleMessage(ref, fd, conn, msg);
+        }
+        if (!open) disconnect(ref, fd);
+    }
+
+    void handleMessage(SessionRef ref, int fd, const std::shared_ptr<TcpConn>& conn, const std::string& msg) {
+        if (msg.empty()) return;
+        int slot = ref.slot;
+        LOG_DEBUG("TcpServer client ", fd, " recv ", msg);
+
+        // 命令：/join <room>  /leave <room>  /resume <room> <seq>  /who  /msg <uid> <text>
+        //       /login <name> <password>  /login <uid>（仅 TRUST_UID_LOGIN 调试用）
+        if (msg[0] == '/') {
+            std::istringstream iss(msg);
+            std::string cmd;
+            iss >> cmd;
+            if (cmd == "/login" && user_cache) {
+                std::string name, password;
+                if (iss >> name >> password) authenticate(ref, name, password);
+                return;
+            }
+            if (cmd == "/who") {
+                who(slot);
+                return;
+            }
+            long long a = -1, b = -1;
+            if (!(iss >> a)) a = -1;
+            if (cmd == "/join" && SessionTable<TcpConn>::validRoom((int)a)) {
+                // 已经在房间里的重复 /join 不算上线
+                if (joinRoom(ref, (int)a, 0, false)) recordPresence(slot, (int)a, true);
+                return;
+            }
+            if (cmd == "/leave" && SessionTable<TcpConn>::validRoom((int)a)) {
+                if (leaveRoom(slot, (int)a)) recordPresence(slot, (int)a, false);
+                return;
+            }
+            if (cmd == "/resume" && SessionTable<TcpConn>::validRoom((int)a) && (iss >> b) && b >= 0) {
+                resume(ref, (int)a, (uint64_t)b);
+                return;
+            }
+            if (cmd == "/login") {
+                // 免密登录不校验身份，不能拿到离线消息
+                if (TRUST_UID_LOGIN && a >= 0) login(ref, (int)a, false);
+                else conn->send("/error login requires name and password\n");
+                return;
+            }
+            if (cmd == "/msg" && a >= 0) {
+                std::string text;
+                std::getline(iss >> std::ws, text);
+                direct(slot, (int)a, text);
+                return;
+            }
+        }
+        broadcast(slot, fd, msg);
+    }
+
+    // 发往当前房间：消息体只构造一次，广播、历史、重放共享同一份
+    void broadcast(int slot, int fd, const std::string& msg) {
+        int room_id = sessions.curRoom(slot);
+        Room& room = getRoom(room_id);
+        std::string body = "User " + std::to_string(fd) + ": " + msg;
+        std::lock_guard<std::mutex> lock(room.mu);
+        uint64_t seq = room.history.nextSeq();
+        auto payload = std::make_shared<const std::string>("#" + std::to_string(seq) + " " + body);
+        room.history.append(payload);
+        for (auto& conn : sessions.connsOf(room.members, slot)) conn->send(*payload);
+        if (on_room_message) on_room_message(room_id, body);
+    }
+
+    // 返回是否真的离开了（原来是成员）
+    bool leaveRoom(int slot, int room_id) {
+        sessions.leaveRoom(slot, room_id);
+        Room& room = getRoom(room_id);
+        std::lock_guard<std::mutex> lock(room.mu);
+        if (!room.members.erase(slot)) return false;
+        if (room.members.empty() && on_room_active) on_room_active(room_id, false);
+        return true;
+    }
+
+    // 加入房间并设为当前房间，replay 为真时在同一把锁下补发 after 之后的消息，
+    // 这样补发和之后的实时消息之间不会漏也不会重。返回是否新加入（原来不是成员）
+    // 在房间锁里确认会话还活着再加成员：disconnect 先关会话再按房间位图清成员，两边不会错过
+    bool joinRoom(SessionRef ref, int room_id, uint64_t after, bool replay) {
+        int slot = ref.slot;
+        auto conn = sessions.conn(slot);
+        if (!conn) return false;
+        sessions.joinRoom(slot, room_id);
+        Room& room = getRoom(room_id);
+        std::lock_guard<std::mutex> lock(room.mu);
+        if (!sessions.alive(ref)) return false;
+        bool joined = room.members.insert(slot).second;
+        if (joined && room.members.size() == 1 && on_room_active) on_room_active(room_id, true);
+        if (!replay) return joined;
+
+        std::vector<Payload> msgs;
+        uint64_t missing_to = 0;
+        if (!room.history.since(after, msgs, &missing_to)) {
+            // 缺的这段已经补不回来了，明确告诉客户端：/gap <room> <from> <to>
+            LOG_WARN("TcpServer room ", room_id, " history evicted up to ", missing_to, ", client ", conn->get_fd());
+            conn->send("/gap " + std::to_string(room_id) + " " + std::to_string(after + 1) + " " +
+                       std::to_string(missing_to) + "\n");
+        }
+        for (auto& p : msgs) conn->send(*p);
+        return joined;
+    }
+
+    // 已登录的会话进出房间时记一次上下线
+    void recordPresence(int slot, int room_id, bool online) {
+        int uid = sessions.uid(slot);
+        if (uid >= 0) presence.record(room_id, uid, online);
+    }
+
+    // 每个 tick 把攒下的上下线变化按房间各发一帧
+    void flushPresence() {
+        for (auto& [room_id, frame] : presence.drain()) {
+            Room& room = getRoom(room_id);
+            std::lock_guard<std::mutex> lock(room.mu);
+            for (auto& conn : sessions.connsOf(room.members)) conn->send(frame);
+        }
+    }
+
+    // 当前房间的在线用户
+    void who(int slot) {
+        int room_id = sessions.curRoom(slot);
+        std::string reply = "/who " + std::to_string(room_id);
+        for (int uid : sessions.onlineInRoom(room_id)) reply += " " + std::to_string(uid);
+        if (auto conn = sessions.conn(slot)) conn->send(reply + "\n");
+    }
+
+    // 上线后在阻塞通道上把离线消息从日志直接推给 socket，只有通过认证的登录才投递
+    // ref 是发起登录时的会话；校验期间连接断开、槽位被新连接复用的话，绑定失败，什么都不做
+    void login(SessionRef ref, int uid, bool authenticated) {
+        int slot = ref.slot;
+        SessionTable<TcpConn>::Binding b;
+        {
+            std::lock_guard<std::mutex> lock(users_mu);
+            if (!sessions.bindUser(ref, uid, &b)) return;
+        }
+        LOG_INFO("TcpServer session ", slot, " login as ", uid);
+        recordLogin(uid, b);
+        if (!authenticated || offline_log->pendingCount(uid) == 0) return;
+        {
+            std::lock_guard<std::mutex> lock(delivery_mu);
+            auto& d = deliveries[slot];
+            if (d.running) {
+                // 上一轮还在跑，结束时看到 again 会按新的 uid 再来一轮
+                d.again = true;
+            }
+            if (d.uid != uid) d.inflight = 0;
+            d.ref = ref;
+            d.uid = uid;
+            if (d.running) return;
+        }
+        pool.submit(DB_LANE, [this, slot]() { runDelivery(slot); });
+    }
+
+    // 只记真正的跳变：同一会话换了 uid，旧 uid 在这些房间下线；
+    // uid 从另一个连接挪过来，两边都在的房间不变，只在一边的房间上线或下线
+    void recordLogin(int uid, const SessionTable<TcpConn>::Binding& b) {
+        if (b.prev_uid == uid) return;
+        if (b.prev_uid >= 0) {
+            for (int room_id : b.rooms) presence.record(room_id, b.prev_uid, false);
+        }
+        for (int room_id : b.rooms) {
+            if (std::find(b.prev_rooms.begin(), b.prev_rooms.end(), room_id) == b.prev_rooms.end())
+                presence.record(room_id, uid, true);
+        }
+        for (int room_id : b.prev_rooms) {
+            if (std::find(b.rooms.begin(), b.rooms.end(), room_id) == b.rooms.end())
+                presence.record(room_id, uid, false);
+        }
+    }
+
+    bool wantsWrite(int fd) {
+        int slot = sessions.slotOfFd(fd);
+        auto conn = sessions.conn(slot);
+        if (!conn) return false;
+        if (conn->backlogged()) return true;
+        std::lock_guard<std::mutex> lock(delivery_mu);
+        return deliveries.count(slot) > 0;
+    }
+
+    // 可写了：先把积压写完，再接着投递离线消息
+    void onWritable(int fd) {
+        int slot = sessions.slotOfFd(fd);
+        auto conn = sessions.conn(slot);
+        if (!conn || !conn->flush()) return;
+        {
+            std::lock_guard<std::mutex> lock(delivery_mu);
+            if (!deliveries.count(slot)) return;
+        }
+        pool.submit(DB_LANE, [this, slot]() { runDelivery(slot); });
+    }
+
+    // 在 db 通道上跑一轮离线投递，同一个槽位同时只有一轮；socket 写满就停，等 EPOLLOUT
+    void runDelivery(int slot) {
+        OfflineDelivery d;
+        {
+            std::lock_guard<std::mutex> lock(delivery_mu);
+            auto it = deliveries.find(slot);
+            if (it == deliveries.end()) return;
+            if (it->second.running) {
+                it->second.again = true;
+                return;
+            }
+            it->second.running = true;
+            it->second.again = false;
+            d = it->second;
+        }
+        bool done = true;
+        auto conn = sessions.conn(slot);   // 持有连接，投递期间 fd 不会被关闭复用
+        if (conn && sessions.alive(d.ref)) {
+            std::lock_guard<std::mutex> wlock(conn->writeMutex());
+            int total = 0;
+            while (!conn->backlogLocked()) {
+                std::string tail;
+                int n = offline_log->deliver(d.uid, conn->get_fd(), d.inflight, tail);
+                total += n;
+                if (!tail.empty()) conn->sendLocked(tail);
+                if (n == 0 && tail.empty()) break;
+            }
+            done = d.inflight == 0 && offline_log->pendingCount(d.uid) == 0;
+            LOG_INFO("TcpServer delivered ", total, " offline messages to ", d.uid, done ? ", done" : ", waiting for EPOLLOUT");
+        }
+        bool again;
+        {
+            std::lock_guard<std::mutex> lock(delivery_mu);
+            auto it = deliveries.find(slot);
+            // 投递期间会话关了，槽位上可能已经是别的会话的投递，不能动
+            if (it == deliveries.end() || it->second.ref.gen != d.ref.gen) return;
+            it->second.running = false;
+            again = it->second.again;
+            if (it->second.uid == d.uid) {
+                if (done && !again) {
+                    deliveries.erase(it);
+                    return;
+                }
+                it->second.inflight = d.inflight;
+            }
+        }
+        if (again) pool.submit(DB_LANE, [this, slot]() { runDelivery(slot); });
+    }
+
+    // 热用户的查找在内存里完成，未命中才查库
+    // 校验密码要算 PBKDF2，比较耗 CPU，统一放到 db 通道上，不占网络通道
+    void authenticate(SessionRef ref, const std::string& name, const std::string& password) {
+        auto check = [this, ref, password](const UserCache::UserPtr& user) {
+            if (!sessions.alive(ref)) return;
+            // 校验要跑几十毫秒，期间会话可能已经换人，login 里按 ref 的代数再确认一次
+            if (user && Password::verify(password, user->password_hash)) {
+                login(ref, user->id, true);
+                return;
+            }
+            LOG_WARN("TcpServer session ", ref.slot, " login failed");
+            if (auto conn = sessions.conn(ref.slot)) conn->send("/error login failed\n");
+        };
+        if (auto user = user_cache->peekByName(name)) {
+            pool.submit(DB_LANE, [user, check]() { check(user); });
+            return;
+        }
+        pool.submit(DB_LANE, [this, name, check]() {
+            check(user_cache->getByName(name));
+        });
+    }
+
+    // 私信：对方在线直接发，不在线写离线日志
+    void direct(int slot, int to_uid, const std::string& text) {
+        std::lock_guard<std::mutex> lock(users_mu);
+        int from_uid = sessions.uid(slot);
+        if (from_uid < 0) {
+            if (auto conn = sessions.conn(slot)) conn->send("/error login first\n");
+            return;
+        }
+        std::string frame = "DM " + std::to_string(from_uid) + ": " + text + "\n";
+        if (auto conn = sessions.conn(sessions.slotOfUser(to_uid))) {
+            conn->send(frame);
+            return;
+        }
+        offline_log->append(to_uid, frame);
+    }
+
+    // 断线重连：内存里还有就直接补发，缺口已淘汰的话先在 db 通道上从数据库补
+    void resume(SessionRef ref, int room_id, uint64_t after) {
+        Room& room = getRoom(room_id);
+        uint64_t first = room.history.firstSeq();
+        if (after + 1 >= first || !history_loader) {
+            if (joinRoom(ref, room_id, after, true)) recordPresence(ref.slot, room_id, true);
+            return;
+        }
+        pool.submit(DB_LANE, [this, ref, room_id, after, first]() {
+            auto conn = sessions.conn(ref.slot);
+            if (!conn || !sessions.alive(ref)) return;
+            for (auto& frame : history_loader(room_id, after + 1, first - 1)) conn->send(frame);
+            // 查库期间会话可能已经关了、槽位被复用，joinRoom 按 ref 的代数再确认
+            if (joinRoom(ref, room_id, first - 1, true)) recordPresence(ref.slot, room_id, true);
+        });
+    }
 };
 
 
@@ -178,7 +702,10 @@ public:
         serv.sin_port = htons(port);
         inet_pton(AF_INET, ip.c_str(), &serv.sin_addr);
 
-        if (::connect(fd, (sockaddr*)&serv, sizeof(serv)) < 0) return false;
+        if (::connect(fd, (sockaddr*)&serv, sizeof(serv)) < 0) {
+            close(fd);
+            return false;
+        }
         LOG_DEBUG("TcpClient connect to %s:%d success", ip.c_str(), port);
         conn = std::make_unique<TcpConn>(fd);
         return true;
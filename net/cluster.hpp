@@ -0,0 +1,500 @@
+#pragma once
+#include <sys/socket.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "debug_logger.hpp"
+#include "define.hpp"
+#include "net/Inet.hpp"
+
+// 一致性哈希环，决定每个房间的"归属节点"
+// 归属节点维护该房间在哪些节点上有成员，节点增减时只有少部分房间换归属
+class HashRing {
+    std::map<uint64_t, int> ring;
+
+    // FNV-1a，各节点进程间结果必须一致，不能用 std::hash
+    static uint64_t hash(const std::string& s) {
+        uint64_t h = 1469598103934665603ULL;
+        for (unsigned char c : s) {
+            h ^= c;
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+public:
+    void addNode(int node, int vnodes = CLUSTER_VNODES) {
+        for (int v = 0; v < vnodes; v++) ring[hash("node-" + std::to_string(node) + "#" + std::to_string(v))] = node;
+    }
+
+    int owner(int room) const {
+        if (ring.empty()) return -1;
+        auto it = ring.lower_bound(hash("room-" + std::to_string(room)));
+        return it == ring.end() ? ring.begin()->second : it->second;
+    }
+};
+
+struct ClusterPeer {
+    int id;
+    std::string ip;
+    int port;
+};
+
+// 集群节点：节点之间用持久 TCP 连接，每个方向一条（本节点连出去的只写，别人连进来的只读）
+// 帧格式：4 字节长度（网络序）+ 文本
+//   S <room> <node>       节点开始有该房间的成员，发给房间归属节点
+//   U <room> <node>       节点不再有该房间的成员
+//   I <room> <n1,n2,...>  归属节点把最新的兴趣列表推给这些节点
+//   M <room> <body>       房间消息，每个有成员的节点只发一次
+// 发往同一节点的帧先攒在缓冲区里，按 CLUSTER_BATCH_MS 或 CLUSTER_BATCH_BYTES 批量写出
+// 写出只在 flush 线程上做：enqueue 可能在房间锁里、reactor 线程上被调用，只追加不做 I/O
+class ClusterNode {
+    struct Link {
+        ClusterPeer peer;
+        std::mutex mu;              // 只保护 outbox 和 dropped
+        std::string outbox;
+        uint64_t dropped = 0;
+        std::mutex io_mu;           // 下面是连接状态，只在 flush 时访问
+        std::unique_ptr<TcpConn> conn;
+        int connecting_fd = -1;
+        std::chrono::steady_clock::time_point connect_started;
+        std::chrono::steady_clock::time_point next_connect;
+        int backoff_ms = 0;
+    };
+
+    int self;
+    int port;
+    HashRing ring;
+    std::unordered_map<int, std::unique_ptr<Link>> links;
+
+    std::mutex mu;
+    std::unordered_map<int, std::set<int>> directory;   // 本节点是归属节点的房间 -> 有成员的节点
+    std::unordered_map<int, std::vector<int>> interest; // 本节点有成员的房间 -> 有成员的节点
+    std::set<int> active;                               // 本节点当前有成员的房间，链路重连时据此重新订阅
+
+    std::function<void(int room, const std::string& body)> on_message;
+
+    std::atomic<bool> running{false};
+    int listen_fd = -1;
+    std::thread accept_thread;
+    std::thread flush_thread;
+    std::mutex flush_mu;
+    std::condition_variable flush_cv;
+    bool flush_now = false;
+    std::mutex inbound_mu;
+    std::vector<int> inbound_fds;
+    std::vector<std::thread> inbound_threads;
+
+    std::atomic<uint64_t> frames_out{0}, batches_out{0}, frames_in{0};
+
+    static std::string encode(const std::string& body) {
+        uint32_t len = htonl((uint32_t)body.size());
+        return std::string(reinterpret_cast<const char*>(&len), 4) + body;
+    }
+
+    void enqueue(int node, const std::string& body) {
+        auto it = links.find(node);
+        if (it == links.end()) return;
+        Link& link = *it->second;
+        std::string frame = encode(body);
+        bool full;
+        {
+            std::lock_guard<std::mutex> lock(link.mu);
+            if (link.outbox.size() + frame.size() > CLUSTER_OUTBOX_BYTES) {
+                if (link.dropped++ == 0) LOG_WARN("Cluster node ", self, " outbox to ", link.peer.id, " full, dropping frames");
+                return;
+            }
+            link.outbox += frame;
+            full = link.outbox.size() >= CLUSTER_BATCH_BYTES;
+        }
+        frames_out++;
+        if (full) {
+            std::lock_guard<std::mutex> lock(flush_mu);
+            flush_now = true;
+            flush_cv.notify_one();
+        }
+    }
+
+    void connectFailed(Link& link, std::chrono::steady_clock::time_point now) {
+        link.backoff_ms = link.backoff_ms == 0 ? CLUSTER_RECONNECT_MIN_MS
+                                               : std::min(link.backoff_ms * 2, CLUSTER_RECONNECT_MAX_MS);
+        link.next_connect = now + std::chrono::milliseconds(link.backoff_ms);
+    }
+
+    // 持有 link.io_mu。非阻塞建连，握手结果在之后的 flush 里用 poll(0) 查，不在这里等
+    bool ensureConnected(Link& link) {
+        if (link.conn) return true;
+        auto now = std::chrono::steady_clock::now();
+        if (link.connecting_fd < 0) {
+            if (now < link.next_connect) return false;
+            int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(link.peer.port);
+            inet_pton(AF_INET, link.peer.ip.c_str(), &addr.sin_addr);
+            if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+                ::close(fd);
+                connectFailed(link, now);   // 对端还没起来，退避后再连
+                return false;
+            }
+            link.connecting_fd = fd;
+            link.connect_started = now;
+        }
+        pollfd pfd{link.connecting_fd, POLLOUT, 0};
+        if (::poll(&pfd, 1, 0) == 0) {
+            if (now - link.connect_started < std::chrono::milliseconds(CLUSTER_CONNECT_TIMEOUT_MS)) return false;
+            LOG_WARN("Cluster node ", self, " connect to ", link.peer.id, " timed out");
+            ::close(link.connecting_fd);
+            link.connecting_fd = -1;
+            connectFailed(link, now);
+            return false;
+        }
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(link.connecting_fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            ::close(link.connecting_fd);
+            link.connecting_fd = -1;
+            connectFailed(link, now);
+            return false;
+        }
+        link.conn = std::make_unique<TcpConn>(link.connecting_fd);
+        link.connecting_fd = -1;
+        link.backoff_ms = 0;
+        LOG_INFO("Cluster node ", self, " linked to ", link.peer.id);
+        resubscribe(link);
+        return true;
+    }
+
+    // 链路（重新）建立时对端可能是刚重启的归属节点，目录是空的：
+    // 以它为归属、本节点当前有成员的房间重新订阅一遍。放在 outbox 最前面，之后排队的 S/U 照常生效
+    void resubscribe(Link& link) {
+        std::string frames;
+        int count = 0;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            for (int room : active) {
+                if (ring.owner(room) != link.peer.id) continue;
+                frames += encode("S " + std::to_string(room) + " " + std::to_string(self));
+                count++;
+            }
+        }
+        if (count == 0) return;
+        {
+            std::lock_guard<std::mutex> lock(link.mu);
+            link.outbox.insert(0, frames);
+        }
+        frames_out += count;
+        LOG_INFO("Cluster node ", self, " resubscribed ", count, " rooms at ", link.peer.id);
+    }
+
+    // 出方向的连接只写不读，可读就说明对端关了（比如重启），趁早重连
+    static bool peerClosed(TcpConn& conn) {
+        pollfd pfd{conn.get_fd(), POLLIN | POLLRDHUP, 0};
+        return ::poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLIN | POLLRDHUP | POLLHUP | POLLERR));
+    }
+
+    // 在锁里把 outbox 换出来，锁外写；socket 是非阻塞的，写不完的部分留在连接里下次续写
+    void flushLink(Link& link) {
+        std::lock_guard<std::mutex> io(link.io_mu);
+        if (link.conn && peerClosed(*link.conn)) {
+            LOG_WARN("Cluster node ", self, " link to ", link.peer.id, " closed by peer, reconnecting");
+            link.conn.reset();
+            link.next_connect = std::chrono::steady_clock::now();
+        }
+        if (!ensureConnected(link)) return;
+        // 上一批还没写完（对端读得慢），新帧先留在 outbox 里
+        if (link.conn->backlogged() && !link.conn->flush()) return;
+        std::string batch;
+        uint64_t dropped;
+        {
+            std::lock_guard<std::mutex> lock(link.mu);
+            batch.swap(link.outbox);
+            dropped = link.dropped;
+            link.dropped = 0;
+        }
+        if (dropped > 0) LOG_WARN("Cluster node ", self, " dropped ", dropped, " frames to ", link.peer.id);
+        if (batch.empty()) return;
+        if (!link.conn->send(batch)) {
+            LOG_WARN("Cluster node ", self, " send to ", link.peer.id, " failed, reconnecting");
+            link.conn.reset();
+            connectFailed(link, std::chrono::steady_clock::now());
+            // 这一批一个字节都没写出去，放回 outbox 前面，连上后重发
+            std::lock_guard<std::mutex> lock(link.mu);
+            if (batch.size() + link.outbox.size() <= CLUSTER_OUTBOX_BYTES) link.outbox.insert(0, batch);
+            else LOG_WARN("Cluster node ", self, " outbox to ", link.peer.id, " full, dropping a batch");
+            return;
+        }
+        batches_out++;
+    }
+
+    // 本节点作为归属节点处理订阅变化，并把新的兴趣列表推给所有相关节点
+    void applySubscription(int room, int node, bool subscribe) {
+        std::vector<int> nodes;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            auto& members = directory[room];
+            if (subscribe) members.insert(node);
+            else members.erase(node);
+            nodes.assign(members.begin(), members.end());
+            if (members.empty()) directory.erase(room);
+        }
+        std::string list;
+        for (int n : nodes) list += (list.empty() ? "" : ",") + std::to_string(n);
+        for (int n : nodes) {
+            if (n == self) applyInterest(room, nodes);
+            else enqueue(n, "I " + std::to_string(room) + " " + list);
+        }
+    }
+
+    void applyInterest(int room, const std::vector<int>& nodes) {
+        std::lock_guard<std::mutex> lock(mu);
+        interest[room] = nodes;
+    }
+
+    void handleFrame(const std::string& body) {
+        frames_in++;
+        std::istringstream iss(body);
+        char type = 0;
+        int room = -1;
+        // 房间号不合法的帧直接丢掉，不能让对端随便让本节点建房间
+        if (!(iss >> type >> room) || !SessionTable<TcpConn>::validRoom(room)) {
+            LOG_WARN("Cluster node ", self, " bad frame: ", body);
+            return;
+        }
+        if (type == 'M') {
+            auto pos = body.find(' ', 2);
+            if (pos != std::string::npos && on_message) on_message(room, body.substr(pos + 1));
+        } else if (type == 'S' || type == 'U') {
+            int node = -1;
+            if (!(iss >> node) || node < 0) {
+                LOG_WARN("Cluster node ", self, " bad frame: ", body);
+                return;
+            }
+            applySubscription(room, node, type == 'S');
+        } else if (type == 'I') {
+            std::string list;
+            iss >> list;
+            // 在链路读线程上解析，不能抛异常；列表不合法就整帧丢掉
+            std::vector<int> nodes;
+            const char* p = list.c_str();
+            while (*p) {
+                char* end = nullptr;
+                errno = 0;
+                long n = std::strtol(p, &end, 10);
+                if (end == p || errno != 0 || n < 0 || n > INT_MAX || (*end != ',' && *end != '\0')) {
+                    LOG_WARN("Cluster node ", self, " bad interest list: ", body);
+                    return;
+                }
+                nodes.push_back((int)n);
+                p = *end == ',' ? end + 1 : end;
+            }
+            applyInterest(room, nodes);
+        } else {
+            LOG_WARN("Cluster node ", self, " bad frame: ", body);
+        }
+    }
+
+    void readLoop(int fd) {
+        TcpConn conn(fd);
+        std::string buf;
+        while (running) {
+            std::string chunk = conn.recv();
+            if (chunk.empty()) break;
+            buf += chunk;
+            std::size_t off = 0;
+            while (buf.size() - off >= 4) {
+                uint32_t len;
+                memcpy(&len, buf.data() + off, 4);
+                len = ntohl(len);
+                if (buf.size() - off - 4 < len) break;
+                handleFrame(buf.substr(off + 4, len));
+                off += 4 + len;
+            }
+            buf.erase(0, off);
+        }
+        LOG_INFO("Cluster node ", self, " inbound link closed");
+        // conn 析构时才关 fd，先从列表里摘掉，stop() 就不会 shutdown 一个已被复用的 fd
+        std::lock_guard<std::mutex> lock(inbound_mu);
+        inbound_fds.erase(std::remove(inbound_fds.begin(), inbound_fds.end(), fd), inbound_fds.end());
+    }
+
+    void acceptLoop() {
+        while (running) {
+            int fd = ::accept(listen_fd, nullptr, nullptr);
+            if (fd < 0) {
+                if (!running) break;
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(inbound_mu);
+            inbound_fds.push_back(fd);
+            inbound_threads.emplace_back(&ClusterNode::readLoop, this, fd);
+        }
+    }
+
+public:
+    ClusterNode(int self_id, int listen_port, const std::vector<ClusterPeer>& peers)
+        : self(self_id), port(listen_port) {
+        ring.addNode(self);
+        for (auto& p : peers) {
+            if (p.id == self) continue;
+            ring.addNode(p.id);
+            auto link = std::make_unique<Link>();
+            link->peer = p;
+            links[p.id] = std::move(link);
+        }
+    }
+
+    ClusterNode(const ClusterNode&) = delete;
+    ClusterNode& operator=(const ClusterNode&) = delete;
+
+    ~ClusterNode() { stop(); }
+
+    int id() const { return self; }
+    int homeOf(int room) const { return ring.owner(room); }
+
+    // 收到其他节点转发来的房间消息时回调，在链路读线程上执行
+    void setMessageHandler(std::function<void(int, const std::string&)> handler) {
+        on_message = std::move(handler);
+    }
+
+    bool start() {
+        listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(port);
+        if (::bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || ::listen(listen_fd, 64) < 0) {
+            LOG_ERROR("Cluster node ", self, " listen on ", port, " failed");
+            ::close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+        running = true;
+        accept_thread = std::thread(&ClusterNode::acceptLoop, this);
+        flush_thread = std::thread([this] {
+            while (running) {
+                {
+                    std::unique_lock<std::mutex> lock(flush_mu);
+                    flush_cv.wait_for(lock, std::chrono::milliseconds(CLUSTER_BATCH_MS), [this] { return flush_now || !running; });
+                    flush_now = false;
+                }
+                flush();
+            }
+        });
+        LOG_INFO("Cluster node ", self, " listening on ", port, " with ", links.size(), " peers");
+        return true;
+    }
+
+    void stop() {
+        if (!running.exchange(false)) return;
+        {
+            std::lock_guard<std::mutex> lock(flush_mu);
+            flush_cv.notify_one();
+        }
+        flush();
+        ::shutdown(listen_fd, SHUT_RDWR);
+        ::close(listen_fd);
+        if (accept_thread.joinable()) accept_thread.join();
+        if (flush_thread.joinable()) flush_thread.join();
+        {
+            std::lock_guard<std::mutex> lock(inbound_mu);
+            for (int fd : inbound_fds) ::shutdown(fd, SHUT_RDWR);
+        }
+        for (auto& t : inbound_threads) {
+            if (t.joinable()) t.join();
+        }
+        for (auto& [id, link] : links) {
+            std::lock_guard<std::mutex> lock(link->io_mu);
+            link->conn.reset();
+            if (link->connecting_fd >= 0) ::close(link->connecting_fd);
+            link->connecting_fd = -1;
+        }
+        LOG_INFO("Cluster node ", self, " stopped, frames out=", frames_out.load(),
+                 " batches out=", batches_out.load(), " frames in=", frames_in.load());
+    }
+
+    void flush() {
+        for (auto& [id, link] : links) flushLink(*link);
+    }
+
+    // 本节点上房间的成员数 0 -> 1 时调用
+    void subscribe(int room) {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            active.insert(room);
+        }
+        int home = ring.owner(room);
+        if (home == self) applySubscription(room, self, true);
+        else enqueue(home, "S " + std::to_string(room) + " " + std::to_string(self));
+    }
+
+    // 本节点上房间的成员数 1 -> 0 时调用
+    void unsubscribe(int room) {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            interest.erase(room);
+            active.erase(room);
+        }
+        int home = ring.owner(room);
+        if (home == self) applySubscription(room, self, false);
+        else enqueue(home, "U " + std::to_string(room) + " " + std::to_string(self));
+    }
+
+    // 把本地产生的房间消息转发给其他有成员的节点，每个节点一次
+    int publish(int room, const std::string& body) {
+        std::vector<int> nodes;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            auto it = interest.find(room);
+            if (it == interest.end()) return 0;
+            nodes = it->second;
+        }
+        int sent = 0;
+        std::string frame = "M " + std::to_string(room) + " " + body;
+        for (int n : nodes) {
+            if (n == self) continue;
+            enqueue(n, frame);
+            sent++;
+        }
+        return sent;
+    }
+
+    std::vector<int> interestedNodes(int room) {
+        std::lock_guard<std::mutex> lock(mu);
+        auto it = interest.find(room);
+        return it == interest.end() ? std::vector<int>() : it->second;
+    }
+};
+
+// 把集群节点挂到 TcpServer 上：房间有无成员的变化转成订阅，本地消息转发，远端消息投递给本地成员
+inline void attachCluster(TcpServer& server, ClusterNode& node) {
+    server.setClusterHooks(
+        [&node](int room, bool active) {
+            if (active) node.subscribe(room);
+            else node.unsubscribe(room);
+        },
+        [&node](int room, const std::string& body) { node.publish(room, body); });
+    node.setMessageHandler([&server](int room, const std::string& body) { server.deliverRemote(room, body); });
+}
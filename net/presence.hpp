@@ -0,0 +1,67 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// 上下线通知的聚合器
+// 一个窗口内每个房间的上下线变化先攒起来，窗口结束时每个房间只发一帧增量；
+// 窗口内下线又上线（或反过来）的抖动直接抵消，重连风暴时不会对每个成员逐条广播。
+class PresenceAggregator {
+    struct Change {
+        bool before;    // 窗口开始前的状态
+        bool now;       // 窗口内最后一次的状态
+    };
+
+    std::mutex mu;
+    std::unordered_map<int, std::unordered_map<int, Change>> pending;   // room -> uid -> 变化
+
+    std::atomic<uint64_t> recorded{0};
+    std::atomic<uint64_t> cancelled{0};
+    std::atomic<uint64_t> frames{0};
+
+public:
+    // 记录一次状态跳变，online 是跳变后的状态
+    void record(int room, int uid, bool online) {
+        recorded++;
+        std::lock_guard<std::mutex> lock(mu);
+        auto& room_changes = pending[room];
+        auto it = room_changes.find(uid);
+        if (it == room_changes.end()) {
+            room_changes.emplace(uid, Change{!online, online});
+        } else {
+            it->second.now = online;
+        }
+    }
+
+    // 取出本窗口的增量帧，格式：/presence <room> +uid -uid ...
+    std::vector<std::pair<int, std::string>> drain() {
+        std::unordered_map<int, std::unordered_map<int, Change>> batch;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            batch.swap(pending);
+        }
+        std::vector<std::pair<int, std::string>> out;
+        for (auto& [room, changes] : batch) {
+            std::string frame;
+            for (auto& [uid, c] : changes) {
+                if (c.before == c.now) {
+                    cancelled++;
+                    continue;
+                }
+                frame += c.now ? " +" : " -";
+                frame += std::to_string(uid);
+            }
+            if (frame.empty()) continue;
+            out.emplace_back(room, "/presence " + std::to_string(room) + frame + "\n");
+            frames++;
+        }
+        return out;
+    }
+
+    uint64_t recordedCount() const { return recorded; }
+    uint64_t cancelledCount() const { return cancelled; }
+    uint64_t frameCount() const { return frames; }
+};
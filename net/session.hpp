@@ -0,0 +1,250 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+#include "define.hpp"
+
+// 在线会话表：热状态按列存放（struct-of-arrays），以稠密的槽位号为下标
+// 在线扫描、广播只读 uid/fd/房间位图几列，每个会话几十字节，
+// 用户资料（User）这种冷数据不放在这里。
+//
+// 槽位会被复用，异步任务要持有 SessionRef 并用 alive() 确认还是原来那个连接。
+struct SessionRef {
+    int slot = -1;
+    uint32_t gen = 0;
+};
+
+template <typename Conn>
+class SessionTable {
+    static constexpr int ROOM_WORDS = (MAX_ROOMS + 63) / 64;
+
+    mutable std::shared_mutex mu;
+    // 热数据
+    std::vector<int32_t> uids;          // -1 未登录
+    std::vector<int32_t> fds;           // -1 空槽
+    std::vector<uint32_t> gens;         // 槽位每复用一次 +1
+    std::vector<int32_t> cur_rooms;     // 发言的目标房间
+    std::vector<uint32_t> last_active;  // 最后活跃的 tick（秒）
+    std::vector<uint64_t> room_bits;    // 每个槽位 ROOM_WORDS 个字，已加入的房间
+    // 冷数据，只有真正发送时才访问
+    std::vector<std::shared_ptr<Conn>> conns;
+
+    std::vector<int> free_slots;
+    std::vector<int> fd_slot;           // fd 是小整数，直接下标映射
+    std::unordered_map<int, int> uid_slot;
+
+    bool aliveLocked(SessionRef r) const {
+        return r.slot >= 0 && r.slot < (int)gens.size() && gens[r.slot] == r.gen && fds[r.slot] >= 0;
+    }
+
+    std::vector<int> roomsLocked(int slot) const {
+        std::vector<int> out;
+        const uint64_t* bits = &room_bits[slot * ROOM_WORDS];
+        for (int w = 0; w < ROOM_WORDS; w++) {
+            for (uint64_t b = bits[w]; b; b &= b - 1) out.push_back(w * 64 + __builtin_ctzll(b));
+        }
+        return out;
+    }
+
+public:
+    static uint32_t nowTick() {
+        static const auto start = std::chrono::steady_clock::now();
+        return (uint32_t)std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+
+    static bool validRoom(int room) { return room >= 0 && room < MAX_ROOMS; }
+
+    SessionRef open(int fd, std::shared_ptr<Conn> conn) {
+        std::unique_lock<std::shared_mutex> lock(mu);
+        int slot;
+        if (!free_slots.empty()) {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        } else {
+            slot = (int)fds.size();
+            uids.push_back(-1);
+            fds.push_back(-1);
+            gens.push_back(0);
+            cur_rooms.push_back(LOBBY_ROOM);
+            last_active.push_back(0);
+            room_bits.resize(room_bits.size() + ROOM_WORDS, 0);
+            conns.emplace_back();
+        }
+        uids[slot] = -1;
+        fds[slot] = fd;
+        gens[slot]++;
+        cur_rooms[slot] = LOBBY_ROOM;
+        last_active[slot] = nowTick();
+        std::fill(room_bits.begin() + slot * ROOM_WORDS, room_bits.begin() + (slot + 1) * ROOM_WORDS, 0);
+        conns[slot] = std::move(conn);
+        if ((int)fd_slot.size() <= fd) fd_slot.resize(fd + 1, -1);
+        fd_slot[fd] = slot;
+        return {slot, gens[slot]};
+    }
+
+    // 关闭会话，把关闭前的 uid 和已加入的房间带出来；r 已过期时什么都不做，返回 false
+    // 槽位此时还不能复用，调用方把房间成员等外部状态清理完再 release()，
+    // 免得清理时误伤复用了这个槽位的新连接
+    bool close(SessionRef r, int* uid_out = nullptr, std::vector<int>* rooms_out = nullptr) {
+        std::unique_lock<std::shared_mutex> lock(mu);
+        if (!aliveLocked(r)) return false;
+        int slot = r.slot;
+        if (uid_out) *uid_out = uids[slot];
+        if (rooms_out) *rooms_out = roomsLocked(slot);
+        if (uids[slot] >= 0) {
+            auto it = uid_slot.find(uids[slot]);
+            if (it != uid_slot.end() && it->second == slot) uid_slot.erase(it);
+        }
+        fd_slot[fds[slot]] = -1;
+        fds[slot] = -1;
+        uids[slot] = -1;
+        gens[slot]++;
+        conns[slot].reset();
+        return true;
+    }
+
+    // close() 之后归还槽位
+    void release(int slot) {
+        std::unique_lock<std::shared_mutex> lock(mu);
+        free_slots.push_back(slot);
+    }
+
+    SessionRef ref(int slot) const {
+        std::shared_lock<std::shared_mutex> lock(mu);
+        return {slot, gens[slot]};
+    }
+
+    bool alive(SessionRef r) const {
+        std::shared_lock<std::shared_mutex> lock(mu);
+        return aliveLocked(r);
+    }
+
+    int slotOfFd(int fd) const {
+        std::shared_lock<std::shared_mutex> lock(mu);
+        return fd >= 0 && fd < (int)fd_slot.size() ? fd_slot[fd] : -1;
+    }
+
+    // reactor 派任务时取下当时的会话，任务执行时再用 alive() 确认
+    SessionRef refOfFd(int fd) const {
+        std::shared_lock<std::shared_mutex> lock(mu);
+        int slot = fd >= 0 && fd < (int)fd_slot.size() ? fd_slot[fd] : -1;
+        return slot < 0 ? SessionRef{} : SessionRef{slot, gens[slot]};
+    }
+
+    int slotOfUser(int uid) const {
+        std::shared_lock<std::shared_mutex> lock(mu);
+        auto it = uid_slot.find(uid);
+        return it == uid_slot.end() ? -1 : it->second;
+    }
+
+    std::shared_ptr<Conn> conn(int slot) const {
+        std::shared_lock<std::shared_mutex> lock(mu);
+        return slot >= 0 && slot < (int)conns.size() ? conns[slot] : nullptr;
+    }
+
+    // 广播用：一次读锁取出一组槽位的连接，跳过 skip 和已关闭的槽位
+    template <typename Slots>
+    std::vector<std::shared_ptr<Conn>> connsOf(const Slots& slots, int skip = -1) const {
+        std::vector<std::shared_ptr<Conn>> out;
+        out.reserve(slots.size());
+        std::shared_lock<std::shared_mutex> lock(mu);
+        for (int slot : slots) {
+            if (slot != skip && slot >= 0 && slot < (int)conns.size() && conns[slot]) out.push_back(conns[slot]);
+        }
+        return out;
+    }
+
+    int uid(int slot) const {
+        std::shared_lock<std::shared_mutex> lock(mu);
+        return uids[slot];
+    }
+
+    // 绑定前后的变化，调用方据此算出真正的上下线
+    struct Binding {
+        int prev_uid = -1;              // 这个会话原来绑定的 uid
+        int prev_slot = -1;             // uid 原来所在的另一个会话，已被解绑
+        std::vector<int> rooms;         // 这个会话已加入的房间
+        std::vector<int> prev_rooms;    // prev_slot 已加入的房间
+    };
+
+    // 同一个 uid 重复登录时，旧槽位解绑
+    // r 的代数对不上（连接已关闭、槽位已被复用）时什么都不做，返回 false
+    bool bindUser(SessionRef r, int uid, Binding* out = nullptr) {
+        std::unique_lock<std::shared_mutex> lock(mu);
+        if (!aliveLocked(r)) return false;
+        int slot = r.slot;
+        int prev = -1;
+        int prev_uid = uids[slot];
+        if (prev_uid >= 0) uid_slot.erase(prev_uid);
+        auto it = uid_slot.find(uid);
+        if (it != uid_slot.end() && it->second != slot) {
+            prev = it->second;
+            uids[prev] = -1;
+        }
+        uids[slot] = uid;
+        uid_slot[uid] = slot;
+        if (out) {
+            out->prev_uid = prev_uid;
+            out->prev_slot = prev;
+            out->rooms = roomsLocked(slot);
+            if (prev >= 0) out->prev_rooms = roomsLocked(prev);
+        }
+        return true;
+    }
+
+    // 每条消息都会调用，只拿读锁，单个字用原子写
+    void touch(int slot) {
+        std::shared_lock<std::shared_mutex> lock(mu);
+        __atomic_store_n(&last_active[slot], nowTick(), __ATOMIC_RELAXED);
+    }
+
+    uint32_t lastActive(int slot) const {
+        std::shared_lock<std::shared_mutex> lock(mu);
+        return __atomic_load_n(&last_active[slot], __ATOMIC_RELAXED);
+    }
+
+    int curRoom(int slot) const {
+        std::shared_lock<std::shared_mutex> lock(mu);
+        return cur_rooms[slot];
+    }
+
+    void joinRoom(int slot, int room) {
+        std::unique_lock<std::shared_mutex> lock(mu);
+        room_bits[slot * ROOM_WORDS + (room >> 6)] |= uint64_t(1) << (room & 63);
+        cur_rooms[slot] = room;
+    }
+
+    void leaveRoom(int slot, int room) {
+        std::unique_lock<std::shared_mutex> lock(mu);
+        room_bits[slot * ROOM_WORDS + (room >> 6)] &= ~(uint64_t(1) << (room & 63));
+        if (cur_rooms[slot] == room) cur_rooms[slot] = LOBBY_ROOM;
+    }
+
+    std::vector<int> roomsOf(int slot) const {
+        std::shared_lock<std::shared_mutex> lock(mu);
+        return roomsLocked(slot);
+    }
+
+    // 在线扫描：只读房间位图一列和 uid 一列
+    std::vector<int> onlineInRoom(int room) const {
+        std::shared_lock<std::shared_mutex> lock(mu);
+        std::vector<int> out;
+        int word = room >> 6;
+        uint64_t mask = uint64_t(1) << (room & 63);
+        for (std::size_t slot = 0; slot < fds.size(); slot++) {
+            if ((room_bits[slot * ROOM_WORDS + word] & mask) && uids[slot] >= 0) out.push_back(uids[slot]);
+        }
+        return out;
+    }
+
+    std::size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(mu);
+        return fds.size() - free_slots.size();
+    }
+};
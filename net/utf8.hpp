@@ -0,0 +1,277 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TEXT_FILTER_X86 1
+#endif
+
+// 接收路径上的文本检查：UTF-8 合法性、控制字符、长度，原地一遍完成
+// 热点是"找出开头有多长是不用改动的合法文本"，这部分按 CPU 能力选 AVX2 / SSE4.1 / 标量实现：
+// 向量版用 Keiser-Lemire 的三张查表同时校验多字节序列，中文等非 ASCII 文本也走快路径；
+// 只有遇到控制字符或非法序列才退回逐字节处理，处理完继续走向量快路径。
+enum class TextCheck {
+    Ok,
+    TooLong,
+    BadUtf8,
+    Control,    // reject_control 为真时遇到控制字符
+};
+
+enum class TextKernel { Auto, Scalar, SSE4, AVX2 };
+
+class TextFilter {
+    using PrefixFn = std::size_t (*)(const unsigned char*, std::size_t);
+
+    static bool printable(unsigned char c) { return c >= 0x20 && c < 0x7f; }
+
+    static std::size_t prefixScalar(const unsigned char* p, std::size_t n) {
+        std::size_t i = 0;
+        while (i < n && printable(p[i])) i++;
+        return i;
+    }
+
+    // 向量版在 j 处发现问题：问题最多牵连前 3 个字节，退到那之前的字符开头
+    static std::size_t backoff(const unsigned char* p, std::size_t j) {
+        for (int s = 0; s < 3 && j > 0 && p[j - 1] >= 0x80; s++) j--;
+        for (int s = 0; s < 3 && j > 0 && (p[j] & 0xc0) == 0x80; s++) j--;
+        return j;
+    }
+
+    // 向量版校验到 i 为止没有错误，但末尾可能停在一个多字节字符中间，退回到它的首字节
+    static std::size_t completeEnd(const unsigned char* p, std::size_t i) {
+        if (i >= 1 && p[i - 1] >= 0xc0) return i - 1;
+        if (i >= 2 && p[i - 2] >= 0xe0) return i - 2;
+        if (i >= 3 && p[i - 3] >= 0xf0) return i - 3;
+        return i;
+    }
+
+#ifdef TEXT_FILTER_X86
+    // 查表的错误位：按 (前一字节高 4 位, 前一字节低 4 位, 当前字节高 4 位) 三张表相与
+    static constexpr uint8_t TOO_SHORT = 1 << 0;    // 首字节后面跟的不是续字节
+    static constexpr uint8_t TOO_LONG = 1 << 1;     // ASCII 后面跟续字节
+    static constexpr uint8_t OVERLONG_3 = 1 << 2;
+    static constexpr uint8_t TOO_LARGE = 1 << 3;    // > U+10FFFF
+    static constexpr uint8_t SURROGATE = 1 << 4;
+    static constexpr uint8_t OVERLONG_2 = 1 << 5;
+    static constexpr uint8_t TOO_LARGE_1000 = 1 << 6;
+    static constexpr uint8_t OVERLONG_4 = 1 << 6;
+    static constexpr uint8_t TWO_CONTS = 1 << 7;    // 续字节后面跟续字节（是否合法看第 3/4 字节检查）
+    static constexpr uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+    static constexpr uint8_t BYTE1_HIGH[16] = {
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2, TOO_SHORT, TOO_SHORT | OVERLONG_3 | SURROGATE,
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+    };
+    static constexpr uint8_t BYTE1_LOW[16] = {
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, CARRY | OVERLONG_2, CARRY, CARRY,
+        CARRY | TOO_LARGE, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000
+    };
+    static constexpr uint8_t BYTE2_HIGH[16] = {
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+    };
+
+    // 返回每个字节是否"有问题"（非法 UTF-8、C0 控制字符、DEL、C1 控制字符）的非零标记
+    // prev1..prev3 是当前字节之前 1..3 个字节
+    __attribute__((target("sse4.1")))
+    static __m128i badSSE4(__m128i v, __m128i prev1, __m128i prev2, __m128i prev3) {
+        const __m128i nib = _mm_set1_epi8(0x0f);
+        const __m128i byte1_high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(BYTE1_HIGH));
+        const __m128i byte1_low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(BYTE1_LOW));
+        const __m128i byte2_high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(BYTE2_HIGH));
+        __m128i sc = _mm_and_si128(
+            _mm_and_si128(_mm_shuffle_epi8(byte1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nib)),
+                          _mm_shuffle_epi8(byte1_low, _mm_and_si128(prev1, nib))),
+            _mm_shuffle_epi8(byte2_high, _mm_and_si128(_mm_srli_epi16(v, 4), nib)));
+        // 三字节序列的第 3 字节、四字节序列的第 3/4 字节必须是续字节
+        __m128i must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xe0 - 0x80))),
+                                      _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xf0 - 0x80))));
+        __m128i err = _mm_xor_si128(_mm_and_si128(must23, _mm_set1_epi8((char)0x80)), sc);
+        __m128i ctrl = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1f)), v),
+                                    _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+        // C1：C2 80..C2 9F
+        __m128i c1 = _mm_and_si128(_mm_cmpeq_epi8(prev1, _mm_set1_epi8((char)0xc2)),
+                                   _mm_cmpgt_epi8(_mm_set1_epi8((char)0xa0), v));
+        return _mm_or_si128(err, _mm_or_si128(ctrl, c1));
+    }
+
+    __attribute__((target("sse4.1")))
+    static std::size_t prefixSSE4(const unsigned char* p, std::size_t n) {
+        __m128i prev = _mm_setzero_si128();
+        std::size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            __m128i bad = badSSE4(v, _mm_alignr_epi8(v, prev, 15), _mm_alignr_epi8(v, prev, 14),
+                                  _mm_alignr_epi8(v, prev, 13));
+            if (!_mm_testz_si128(bad, bad)) {
+                unsigned mask = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(bad, _mm_setzero_si128())) & 0xffff;
+                return backoff(p, i + __builtin_ctz(mask));
+            }
+            prev = v;
+        }
+        std::size_t end = completeEnd(p, i);
+        if (end < i) return end;
+        return i + prefixScalar(p + i, n - i);
+    }
+
+    __attribute__((target("avx2")))
+    static std::size_t prefixAVX2(const unsigned char* p, std::size_t n) {
+        const __m256i nib = _mm256_set1_epi8(0x0f);
+        // 查表在每个 128 位通道内进行，表复制到两个通道
+        const __m256i byte1_high = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(BYTE1_HIGH)));
+        const __m256i byte1_low = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(BYTE1_LOW)));
+        const __m256i byte2_high = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(BYTE2_HIGH)));
+        __m256i prev = _mm256_setzero_si256();
+        std::size_t i = 0;
+        for (; i + 32 <= n; i += 32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+            // 跨 128 位通道取前 1..3 个字节
+            __m256i carry = _mm256_permute2x128_si256(prev, v, 0x21);
+            __m256i prev1 = _mm256_alignr_epi8(v, carry, 15);
+            __m256i prev2 = _mm256_alignr_epi8(v, carry, 14);
+            __m256i prev3 = _mm256_alignr_epi8(v, carry, 13);
+            __m256i sc = _mm256_and_si256(
+                _mm256_and_si256(_mm256_shuffle_epi8(byte1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nib)),
+                                 _mm256_shuffle_epi8(byte1_low, _mm256_and_si256(prev1, nib))),
+                _mm256_shuffle_epi8(byte2_high, _mm256_and_si256(_mm256_srli_epi16(v, 4), nib)));
+            __m256i must23 = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xe0 - 0x80))),
+                                             _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xf0 - 0x80))));
+            __m256i err = _mm256_xor_si256(_mm256_and_si256(must23, _mm256_set1_epi8((char)0x80)), sc);
+            __m256i ctrl = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(0x1f)), v),
+                                           _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f)));
+            __m256i c1 = _mm256_and_si256(_mm256_cmpeq_epi8(prev1, _mm256_set1_epi8((char)0xc2)),
+                                          _mm256_cmpgt_epi8(_mm256_set1_epi8((char)0xa0), v));
+            __m256i bad = _mm256_or_si256(err, _mm256_or_si256(ctrl, c1));
+            unsigned mask = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bad, _mm256_setzero_si256()));
+            if (mask) return backoff(p, i + __builtin_ctz(mask));
+            prev = v;
+        }
+        std::size_t end = completeEnd(p, i);
+        if (end < i) return end;
+        return i + prefixSSE4(p + i, n - i);
+    }
+#endif
+
+    static PrefixFn pick(TextKernel k) {
+#ifdef TEXT_FILTER_X86
+        switch (k) {
+            case TextKernel::Scalar:
+                return prefixScalar;
+            case TextKernel::SSE4:
+                return __builtin_cpu_supports("sse4.1") ? prefixSSE4 : prefixScalar;
+            case TextKernel::AVX2:
+                return __builtin_cpu_supports("avx2") ? prefixAVX2 : prefixScalar;
+            case TextKernel::Auto:
+                break;
+        }
+        static const PrefixFn best = __builtin_cpu_supports("avx2")   ? prefixAVX2
+                                     : __builtin_cpu_supports("sse4.1") ? prefixSSE4
+                                                                        : prefixScalar;
+        return best;
+#else
+        (void)k;
+        return prefixScalar;
+#endif
+    }
+
+    // 解码一个多字节序列，返回长度，非法返回 0；按 RFC 3629 拒绝过长编码、代理区和超范围码点
+    static int decode(const unsigned char* p, std::size_t n, uint32_t& cp) {
+        unsigned char c = p[0];
+        int len;
+        uint32_t min;
+        if (c >= 0xc2 && c <= 0xdf) { len = 2; cp = c & 0x1f; min = 0x80; }
+        else if (c >= 0xe0 && c <= 0xef) { len = 3; cp = c & 0x0f; min = 0x800; }
+        else if (c >= 0xf0 && c <= 0xf4) { len = 4; cp = c & 0x07; min = 0x10000; }
+        else return 0;
+        if ((std::size_t)len > n) return 0;
+        for (int k = 1; k < len; k++) {
+            if ((p[k] & 0xc0) != 0x80) return 0;
+            cp = (cp << 6) | (p[k] & 0x3f);
+        }
+        if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)) return 0;
+        return len;
+    }
+
+public:
+    static const char* kernelName(TextKernel k = TextKernel::Auto) {
+        PrefixFn fn = pick(k);
+#ifdef TEXT_FILTER_X86
+        if (fn == prefixAVX2) return "avx2";
+        if (fn == prefixSSE4) return "sse4.1";
+#endif
+        (void)fn;
+        return "scalar";
+    }
+
+    // 末尾被截断的多字节序列的字节数（0-3）：开头是合法的首字节，只是后续字节还没到
+    // 按字节流读取时用它把这几个字节留到下一次，别的非法情况交给 scrub 去拒绝
+    static std::size_t incompleteTail(const std::string& msg) {
+        std::size_t n = msg.size();
+        std::size_t i = n;
+        while (i > 0 && n - i < 3 && ((unsigned char)msg[i - 1] & 0xc0) == 0x80) i--;
+        if (i == 0) return 0;
+        unsigned char c = msg[i - 1];
+        std::size_t len = (c >= 0xc2 && c <= 0xdf) ? 2 : (c >= 0xe0 && c <= 0xef) ? 3 : (c >= 0xf0 && c <= 0xf4) ? 4 : 0;
+        std::size_t have = n - i + 1;
+        return len > have ? have : 0;
+    }
+
+    // 原地检查并清洗 msg：
+    //  - 超过 max_len 字节直接拒绝
+    //  - 非法 UTF-8（包括被截断在末尾的序列）拒绝
+    //  - C0/C1 控制字符和 DEL 删掉（保留 \n 和 \t），reject_control 为真时改为拒绝
+    static TextCheck scrub(std::string& msg, std::size_t max_len, bool reject_control = false,
+                           TextKernel kernel = TextKernel::Auto) {
+        if (msg.size() > max_len) return TextCheck::TooLong;
+        PrefixFn prefix = pick(kernel);
+        unsigned char* p = reinterpret_cast<unsigned char*>(&msg[0]);
+        std::size_t n = msg.size();
+        std::size_t r = 0, w = 0;
+
+        while (r < n) {
+            std::size_t k = prefix(p + r, n - r);
+            if (k) {
+                if (w != r) memmove(p + w, p + r, k);
+                w += k;
+                r += k;
+                if (r == n) break;
+            }
+            unsigned char c = p[r];
+            if (c < 0x80) {
+                // SIMD 前缀遇到后面的非法字节会往回退，这里可能停在可打印字符上，照常保留
+                if ((c >= 0x20 && c != 0x7f) || c == '\n' || c == '\t') {
+                    p[w++] = c;
+                } else if (reject_control) {
+                    return TextCheck::Control;
+                }
+                r++;
+                continue;
+            }
+            uint32_t cp;
+            int len = decode(p + r, n - r, cp);
+            if (len == 0) return TextCheck::BadUtf8;
+            if (cp < 0xa0) {            // C1 控制字符 U+0080..U+009F
+                if (reject_control) return TextCheck::Control;
+            } else {
+                if (w != r) memmove(p + w, p + r, len);
+                w += len;
+            }
+            r += len;
+        }
+        msg.resize(w);
+        return TextCheck::Ok;
+    }
+};
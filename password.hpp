@@ -0,0 +1,169 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+#include "define.hpp"
+
+// 密码哈希：PBKDF2-HMAC-SHA256，加盐，多轮迭代
+// 库里存的格式：pbkdf2-sha256$<轮数>$<盐 hex>$<哈希 hex>
+// 只依赖标准库，不引入 OpenSSL
+class Password {
+    struct Sha256 {
+        uint32_t h[8];
+        uint8_t buf[64];
+        uint64_t total = 0;
+        std::size_t used = 0;
+
+        static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+        Sha256() {
+            static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                             0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+            memcpy(h, init, sizeof(h));
+        }
+
+        void block(const uint8_t* p) {
+            static const uint32_t k[64] = {
+                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+            uint32_t w[64];
+            for (int i = 0; i < 16; i++)
+                w[i] = (uint32_t)p[i * 4] << 24 | (uint32_t)p[i * 4 + 1] << 16 | (uint32_t)p[i * 4 + 2] << 8 | p[i * 4 + 3];
+            for (int i = 16; i < 64; i++) {
+                uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+            }
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+            for (int i = 0; i < 64; i++) {
+                uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+                uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                hh = g; g = f; f = e; e = d + t1;
+                d = c; c = b; b = a; a = t1 + t2;
+            }
+            h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+        }
+
+        void update(const uint8_t* p, std::size_t n) {
+            total += n;
+            while (n > 0) {
+                std::size_t take = std::min(n, 64 - used);
+                memcpy(buf + used, p, take);
+                used += take;
+                p += take;
+                n -= take;
+                if (used == 64) {
+                    block(buf);
+                    used = 0;
+                }
+            }
+        }
+
+        void finish(uint8_t out[32]) {
+            uint64_t bits = total * 8;
+            uint8_t pad = 0x80;
+            update(&pad, 1);
+            pad = 0;
+            while (used != 56) update(&pad, 1);
+            uint8_t len[8];
+            for (int i = 0; i < 8; i++) len[i] = (uint8_t)(bits >> (56 - 8 * i));
+            update(len, 8);
+            for (int i = 0; i < 8; i++) {
+                out[i * 4] = (uint8_t)(h[i] >> 24);
+                out[i * 4 + 1] = (uint8_t)(h[i] >> 16);
+                out[i * 4 + 2] = (uint8_t)(h[i] >> 8);
+                out[i * 4 + 3] = (uint8_t)h[i];
+            }
+        }
+    };
+
+    static void hmac(const std::string& key, const uint8_t* msg, std::size_t n, uint8_t out[32]) {
+        uint8_t k[64] = {0};
+        if (key.size() > 64) {
+            Sha256 kh;
+            kh.update(reinterpret_cast<const uint8_t*>(key.data()), key.size());
+            kh.finish(k);
+        } else {
+            memcpy(k, key.data(), key.size());
+        }
+        uint8_t ipad[64], opad[64];
+        for (int i = 0; i < 64; i++) {
+            ipad[i] = k[i] ^ 0x36;
+            opad[i] = k[i] ^ 0x5c;
+        }
+        uint8_t inner[32];
+        Sha256 in;
+        in.update(ipad, 64);
+        in.update(msg, n);
+        in.finish(inner);
+        Sha256 o;
+        o.update(opad, 64);
+        o.update(inner, 32);
+        o.finish(out);
+    }
+
+    static std::string toHex(const uint8_t* p, std::size_t n) {
+        static const char* digits = "0123456789abcdef";
+        std::string s;
+        for (std::size_t i = 0; i < n; i++) {
+            s += digits[p[i] >> 4];
+            s += digits[p[i] & 0xf];
+        }
+        return s;
+    }
+
+public:
+    // PBKDF2-HMAC-SHA256，只取第一块（32 字节）
+    static std::string derive(const std::string& password, const std::string& salt, int iterations) {
+        std::string msg = salt + std::string("\0\0\0\1", 4);
+        uint8_t u[32], t[32];
+        hmac(password, reinterpret_cast<const uint8_t*>(msg.data()), msg.size(), u);
+        memcpy(t, u, 32);
+        for (int i = 1; i < iterations; i++) {
+            hmac(password, u, 32, u);
+            for (int j = 0; j < 32; j++) t[j] ^= u[j];
+        }
+        return toHex(t, 32);
+    }
+
+    // 生成入库的字符串，注册和改密码时用
+    static std::string make(const std::string& password, int iterations = PASSWORD_HASH_ITERATIONS) {
+        std::random_device rd;
+        uint8_t salt[16];
+        for (auto& b : salt) b = (uint8_t)rd();
+        std::string salt_hex = toHex(salt, sizeof(salt));
+        return "pbkdf2-sha256$" + std::to_string(iterations) + "$" + salt_hex + "$" + derive(password, salt_hex, iterations);
+    }
+
+    // 按库里记录的盐和轮数重新计算，再做等时比较；格式不对一律失败
+    static bool verify(const std::string& password, const std::string& stored) {
+        const std::string prefix = "pbkdf2-sha256$";
+        if (stored.compare(0, prefix.size(), prefix) != 0) return false;
+        std::size_t p1 = stored.find('$', prefix.size());
+        std::size_t p2 = p1 == std::string::npos ? p1 : stored.find('$', p1 + 1);
+        if (p2 == std::string::npos) return false;
+        std::string iter_str = stored.substr(prefix.size(), p1 - prefix.size());
+        if (iter_str.empty() || iter_str.size() > 7 || iter_str.find_first_not_of("0123456789") != std::string::npos)
+            return false;
+        int iterations = std::stoi(iter_str);
+        if (iterations <= 0) return false;
+        std::string salt = stored.substr(p1 + 1, p2 - p1 - 1);
+        return equals(derive(password, salt, iterations), stored.substr(p2 + 1));
+    }
+
+    // 等时比较：耗时只和长度有关，不因第一个不同的字节提前返回
+    static bool equals(const std::string& a, const std::string& b) {
+        if (a.size() != b.size()) return false;
+        unsigned char diff = 0;
+        for (std::size_t i = 0; i < a.size(); i++) diff |= (unsigned char)(a[i] ^ b[i]);
+        return diff == 0;
+    }
+};
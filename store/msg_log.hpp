@@ -0,0 +1,411 @@
+#pragma once
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <errno.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "debug_logger.hpp"
+#include "define.hpp"
+
+// 离线消息的本地追加日志
+// 消息按到达顺序追加到 mmap 的分段文件里，每个接收者在内存里维护一个待投递位置列表；
+// 用户上线时直接从映射区分散写（sendmsg）到 socket，不经过数据库，也不做用户态拷贝。
+// 所有接收者都确认过的分段整段删除。
+// 追加只做内存拷贝，msync 由后台线程按条数或时间组提交，调用方（网络线程）不会被磁盘阻塞。
+// 确认同样只改内存，确认文件的写入和旧段的删除也放在后台线程上。
+class MessageLog {
+    static constexpr uint32_t MAGIC = 0x4d4c4f47;   // "MLOG"
+
+    struct RecordHeader {
+        uint32_t magic;
+        uint32_t len;
+        int32_t recipient;
+        uint32_t crc;           // 覆盖消息体和 len/recipient/id
+        uint64_t id;
+    };
+
+    // msync 不保证页的落盘顺序，掉电后可能头在、消息体不在，恢复时靠 CRC 认出来
+    static uint32_t crc32(uint32_t crc, const void* data, std::size_t n) {
+        static const std::array<uint32_t, 256> table = [] {
+            std::array<uint32_t, 256> t{};
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                t[i] = c;
+            }
+            return t;
+        }();
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        crc = ~crc;
+        while (n--) crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    // payload_crc 是消息体的 CRC，追加时在锁外先算好
+    static uint32_t recordCrc(uint32_t payload_crc, const RecordHeader& h) {
+        uint32_t crc = crc32(payload_crc, &h.len, sizeof(h.len));
+        crc = crc32(crc, &h.recipient, sizeof(h.recipient));
+        return crc32(crc, &h.id, sizeof(h.id));
+    }
+
+    struct Segment {
+        uint64_t base;          // 段内第一条记录的 id
+        std::string path;
+        int fd = -1;
+        char* data = nullptr;
+        std::size_t capacity = 0;
+        std::size_t used = 0;
+        std::size_t synced = 0; // [0, synced) 已经落盘
+        int pending = 0;        // 还没被确认的记录数
+
+        ~Segment() {
+            if (data) munmap(data, capacity);
+            if (fd >= 0) close(fd);
+        }
+    };
+
+    struct Location {
+        std::shared_ptr<Segment> seg;
+        std::size_t offset;     // 消息体在段内的偏移
+        uint32_t len;
+        uint64_t id;
+    };
+
+    std::string dir;
+    std::size_t segment_bytes;
+    int sync_records;
+    std::chrono::milliseconds sync_interval;
+
+    std::mutex mu;
+    std::deque<std::shared_ptr<Segment>> segments;   // 最后一个是正在写的段
+    std::unordered_map<int, std::deque<Location>> pending;
+    std::unordered_map<int, uint64_t> acked;         // 接收者 -> 已确认的最大 id
+    std::vector<std::pair<int, uint64_t>> new_acks;  // 还没写进确认文件的确认
+    uint64_t next_id = 1;
+
+    // 组提交：后台线程攒够 sync_records 条或每隔 sync_interval 就 msync 一次
+    int unsynced = 0;           // 由 mu 保护
+    bool stopping = false;
+    std::condition_variable sync_cv;
+    std::mutex sync_mu;         // 串行化 sync()
+    std::thread flusher;
+
+    static std::size_t align8(std::size_t n) { return (n + 7) & ~std::size_t(7); }
+
+    std::string segmentPath(uint64_t base) const {
+        char name[64];
+        snprintf(name, sizeof(name), "/seg_%020llu.log", (unsigned long long)base);
+        return dir + name;
+    }
+
+    std::shared_ptr<Segment> mapSegment(const std::string& path, uint64_t base, bool create) {
+        auto seg = std::make_shared<Segment>();
+        seg->base = base;
+        seg->path = path;
+        seg->fd = ::open(path.c_str(), O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0644);
+        if (seg->fd < 0) {
+            LOG_ERROR("MessageLog open ", path, " failed: ", strerror(errno));
+            throw std::runtime_error("message log open failed: " + path);
+        }
+        struct stat st{};
+        fstat(seg->fd, &st);
+        seg->capacity = create ? segment_bytes : (std::size_t)st.st_size;
+        if (create && ftruncate(seg->fd, (off_t)seg->capacity) != 0) {
+            LOG_ERROR("MessageLog ftruncate ", path, " failed: ", strerror(errno));
+            throw std::runtime_error("message log ftruncate failed: " + path);
+        }
+        void* p = mmap(nullptr, seg->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, seg->fd, 0);
+        if (p == MAP_FAILED) {
+            LOG_ERROR("MessageLog mmap ", path, " failed: ", strerror(errno));
+            throw std::runtime_error("message log mmap failed: " + path);
+        }
+        seg->data = static_cast<char*>(p);
+        return seg;
+    }
+
+    // 重启时扫描已有分段，重建每个接收者的待投递列表
+    void recover() {
+        std::ifstream ifs(dir + "/acks");
+        int uid;
+        uint64_t id;
+        while (ifs >> uid >> id) {
+            acked[uid] = std::max(acked[uid], id);
+            // 段被截断后记录可能一条不剩，id 也不能退回到已确认的范围里，否则新消息重启后会被当成已确认
+            next_id = std::max(next_id, id + 1);
+        }
+
+        std::vector<std::string> names;
+        if (DIR* d = opendir(dir.c_str())) {
+            while (dirent* ent = readdir(d)) {
+                std::string name = ent->d_name;
+                if (name.compare(0, 4, "seg_") == 0) names.push_back(name);
+            }
+            closedir(d);
+        }
+        std::sort(names.begin(), names.end());
+
+        for (auto& name : names) {
+            uint64_t base = std::stoull(name.substr(4));
+            auto seg = mapSegment(dir + "/" + name, base, false);
+            std::size_t off = 0;
+            while (off + sizeof(RecordHeader) <= seg->capacity) {
+                RecordHeader h;
+                memcpy(&h, seg->data + off, sizeof(h));
+                if (h.magic != MAGIC || off + sizeof(h) + h.len > seg->capacity) break;
+                // 校验不过说明这条没写完整，后面的也不可信，这一段就恢复到这里
+                if (h.crc != recordCrc(crc32(0, seg->data + off + sizeof(h), h.len), h)) {
+                    LOG_WARN("MessageLog ", seg->path, " bad record at ", off, ", truncating");
+                    // 清掉残留，之后追加到这里的记录后面不会再接上旧记录
+                    memset(seg->data + off, 0, seg->capacity - off);
+                    break;
+                }
+                if (h.id > acked[h.recipient]) {
+                    pending[h.recipient].push_back({seg, off + sizeof(h), h.len, h.id});
+                    seg->pending++;
+                }
+                next_id = std::max(next_id, h.id + 1);
+                off += align8(sizeof(h) + h.len);
+            }
+            seg->used = off;
+            seg->synced = off;
+            segments.push_back(seg);
+        }
+        // 除了最后一段，没有待投递记录的段直接删掉
+        while (segments.size() > 1 && segments.front()->pending == 0) {
+            ::unlink(segments.front()->path.c_str());
+            segments.pop_front();
+        }
+        LOG_INFO("MessageLog recovered ", segments.size(), " segments, next id ", next_id);
+    }
+
+    // 写满的旧段不在这里 msync，它剩下没落盘的部分由后台线程补上
+    void rotate() {
+        segments.push_back(mapSegment(segmentPath(next_id), next_id, true));
+        LOG_INFO("MessageLog new segment ", segments.back()->path);
+    }
+
+    void flushLoop() {
+        std::unique_lock<std::mutex> lock(mu);
+        while (!stopping) {
+            sync_cv.wait_for(lock, sync_interval, [this] { return stopping || unsynced >= sync_records; });
+            if (stopping) continue;
+            bool need_sync = unsynced > 0;
+            bool need_acks = !new_acks.empty();
+            if (!need_sync && !need_acks) continue;
+            lock.unlock();
+            if (need_sync) sync();
+            if (need_acks) persistAcks();
+            lock.lock();
+        }
+    }
+
+    // 把新的确认追加到确认文件，已全部确认的旧段整段删除；文件操作都不持有 mu
+    // 只在后台线程和析构时调用。确认文件不单独 fsync，崩溃后最多重复投递一次
+    void persistAcks() {
+        std::vector<std::pair<int, uint64_t>> lines;
+        std::vector<std::shared_ptr<Segment>> dead;
+        std::vector<std::pair<int, uint64_t>> snapshot;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            lines.swap(new_acks);
+            while (segments.size() > 1 && segments.front()->pending == 0) {
+                dead.push_back(segments.front());
+                segments.pop_front();
+            }
+            if (!dead.empty()) snapshot.assign(acked.begin(), acked.end());
+        }
+        if (!lines.empty()) {
+            std::ofstream ofs(dir + "/acks", std::ios::app);
+            for (auto& [uid, id] : lines) ofs << uid << " " << id << "\n";
+        }
+        if (dead.empty()) return;
+        // 还在投递的 Location 持有段的映射，unlink 之后照样能读
+        for (auto& seg : dead) {
+            ::unlink(seg->path.c_str());
+            LOG_INFO("MessageLog compacted ", seg->path);
+        }
+        // 确认文件顺便重写，避免无限增长
+        std::string tmp = dir + "/acks.tmp";
+        {
+            std::ofstream ofs(tmp, std::ios::trunc);
+            for (auto& [uid, id] : snapshot) ofs << uid << " " << id << "\n";
+        }
+        ::rename(tmp.c_str(), (dir + "/acks").c_str());
+    }
+
+public:
+    explicit MessageLog(const std::string& dir,
+                        std::size_t segment_bytes = MSG_LOG_SEGMENT_BYTES,
+                        int sync_records = MSG_LOG_SYNC_RECORDS,
+                        int sync_ms = MSG_LOG_SYNC_MS)
+        : dir(dir), segment_bytes(segment_bytes), sync_records(sync_records), sync_interval(sync_ms) {
+        ::mkdir(dir.c_str(), 0755);
+        recover();
+        if (segments.empty()) rotate();
+        flusher = std::thread([this] { flushLoop(); });
+    }
+
+    MessageLog(const MessageLog&) = delete;
+    MessageLog& operator=(const MessageLog&) = delete;
+
+    ~MessageLog() {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            stopping = true;
+        }
+        sync_cv.notify_one();
+        flusher.join();
+        sync();
+        persistAcks();
+    }
+
+    // 追加一条发给 recipient 的消息，返回记录 id
+    uint64_t append(int recipient, const std::string& payload) {
+        std::size_t need = align8(sizeof(RecordHeader) + payload.size());
+        if (need > segment_bytes) {
+            LOG_ERROR("MessageLog record too large: ", payload.size());
+            throw std::runtime_error("message log record too large");
+        }
+        uint32_t payload_crc = crc32(0, payload.data(), payload.size());
+        uint64_t id;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            if (segments.back()->used + need > segments.back()->capacity) rotate();
+            auto& seg = segments.back();
+            id = next_id++;
+            RecordHeader h{MAGIC, (uint32_t)payload.size(), recipient, 0, id};
+            h.crc = recordCrc(payload_crc, h);
+            memcpy(seg->data + seg->used + sizeof(h), payload.data(), payload.size());
+            memcpy(seg->data + seg->used, &h, sizeof(h));
+            pending[recipient].push_back({seg, seg->used + sizeof(h), h.len, id});
+            seg->pending++;
+            seg->used += need;
+            if (++unsynced >= sync_records) sync_cv.notify_one();
+        }
+        return id;
+    }
+
+    // 把所有段里还没落盘的部分 msync 掉，msync 时不持有 mu，追加可以继续
+    void sync() {
+        std::lock_guard<std::mutex> sync_lock(sync_mu);
+        struct Range {
+            std::shared_ptr<Segment> seg;
+            std::size_t from, to;
+        };
+        std::vector<Range> ranges;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            for (auto& seg : segments) {
+                if (seg->synced < seg->used) ranges.push_back({seg, seg->synced, seg->used});
+            }
+            unsynced = 0;
+        }
+        long page = sysconf(_SC_PAGESIZE);
+        for (auto& r : ranges) {
+            std::size_t start = r.from / page * page;
+            if (msync(r.seg->data + start, r.to - start, MS_SYNC) != 0) {
+                LOG_ERROR("MessageLog msync failed: ", strerror(errno));
+            }
+        }
+        std::lock_guard<std::mutex> lock(mu);
+        for (auto& r : ranges) r.seg->synced = std::max(r.seg->synced, r.to);
+    }
+
+    std::size_t pendingCount(int recipient) {
+        std::lock_guard<std::mutex> lock(mu);
+        auto it = pending.find(recipient);
+        return it == pending.end() ? 0 : it->second.size();
+    }
+
+    // 把 recipient 的待投递消息直接从映射区写到 socket，返回完整写出的条数
+    // 非阻塞 socket 写满时停下。最后一条只写出一部分时，剩下的字节放进 tail，
+    // 调用方必须原样交给连接的输出缓冲，这条记录的 id 记在 inflight 里；
+    // 等输出缓冲写完，下一次 deliver 先确认它。连接断了就不确认，重连后整条重发，不会重放半条。
+    int deliver(int recipient, int sock_fd, uint64_t& inflight, std::string& tail) {
+        if (inflight) {
+            ack(recipient, inflight);
+            inflight = 0;
+        }
+        int delivered = 0;
+        for (;;) {
+            // 每轮只从队头取一次 sendmsg 写得下的窗口，写完立即确认出队，积压再多也不整队拷贝
+            Location locs[IOV_MAX > 64 ? 64 : IOV_MAX];
+            int n = 0;
+            {
+                std::lock_guard<std::mutex> lock(mu);
+                auto it = pending.find(recipient);
+                if (it == pending.end()) break;
+                for (auto& loc : it->second) {
+                    if (n == (int)(sizeof(locs) / sizeof(locs[0]))) break;
+                    locs[n++] = loc;
+                }
+            }
+            iovec iov[sizeof(locs) / sizeof(locs[0])];
+            std::size_t total = 0;
+            for (int k = 0; k < n; k++) {
+                iov[k].iov_base = locs[k].seg->data + locs[k].offset;
+                iov[k].iov_len = locs[k].len;
+                total += locs[k].len;
+            }
+            // 用 sendmsg 而不是 writev，对端关闭时不触发 SIGPIPE
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = n;
+            ssize_t ret = ::sendmsg(sock_fd, &msg, MSG_NOSIGNAL);
+            if (ret < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) LOG_ERROR("MessageLog sendmsg failed: ", strerror(errno));
+                break;
+            }
+            // 统计完整写出的记录
+            std::size_t left = (std::size_t)ret;
+            int full = 0;
+            while (full < n && left >= locs[full].len) {
+                left -= locs[full].len;
+                full++;
+            }
+            if (full > 0) ack(recipient, locs[full - 1].id);
+            delivered += full;
+            if (left > 0) {
+                const Location& loc = locs[full];
+                tail.assign(loc.seg->data + loc.offset + left, loc.len - left);
+                inflight = loc.id;
+            }
+            if ((std::size_t)ret < total) break;
+        }
+        return delivered;
+    }
+
+    // 确认 recipient 收到了 id 及之前的所有消息
+    void ack(int recipient, uint64_t id) {
+        std::lock_guard<std::mutex> lock(mu);
+        auto it = pending.find(recipient);
+        if (it == pending.end()) return;
+        auto& q = it->second;
+        while (!q.empty() && q.front().id <= id) {
+            q.front().seg->pending--;
+            q.pop_front();
+        }
+        if (q.empty()) pending.erase(it);
+        acked[recipient] = std::max(acked[recipient], id);
+        new_acks.emplace_back(recipient, id);
+    }
+};
@@ -3,6 +3,14 @@
 #include <random>
 #include <chrono>
 #include "thread.hpp"
+#include "entity/room.hpp"
+#include "store/msg_log.hpp"
+#include "entity/user_cache.hpp"
+#include "net/session.hpp"
+#include "net/presence.hpp"
+#include "net/utf8.hpp"
+#include "net/cluster.hpp"
+#include "password.hpp"
 std::random_device rd; // 真实随机数产生器
 
 std::mt19937 mt(rd()); //生成计算随机数mt
@@ -77,3 +85,427 @@ void thread_pool_test()
     std::cout << "All done" << std::endl;
 }
 
+
+// 通道隔离：db 通道被慢任务占满时，net 通道的任务仍然能及时执行
+void thread_pool_lane_test()
+{
+    ThreadPool pool(2, NET_LANE);
+    pool.addLane(DB_LANE, 1, 3);
+    pool.init();
+
+    // 模拟一批慢查询
+    std::vector<std::future<void>> slow;
+    for (int i = 0; i < 6; ++i)
+        slow.push_back(pool.submit(DB_LANE, [] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }));
+
+    auto start = std::chrono::steady_clock::now();
+    int res = pool.submit(NET_LANE, [](int a, int b) { return a * b; }, 2, 3).get();
+    auto cost = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    std::cout << "net task (" << res << ") finished in " << cost << " ms while db lane busy" << std::endl;
+
+    for (auto& f : slow) f.get();
+    pool.shutdown();
+
+    for (auto& s : pool.stats())
+        std::cout << "lane " << s.name << " submitted=" << s.submitted
+                  << " completed=" << s.completed << " max_queued=" << s.max_queued
+                  << " avg_wait_us=" << s.avg_wait_us << std::endl;
+}
+
+// 房间历史：按条数和字节数淘汰，按序号补发
+void room_history_test()
+{
+    RoomHistory history(4, 1024);
+    for (int i = 1; i <= 6; ++i)
+        history.append(std::make_shared<const std::string>("msg" + std::to_string(i)));
+
+    std::vector<Payload> out;
+    bool complete = history.since(3, out);
+    std::cout << "since 3: complete=" << complete << " count=" << out.size()
+              << " first=" << (out.empty() ? "" : *out.front()) << std::endl;   // 1 3 msg4
+
+    out.clear();
+    uint64_t missing_to = 0;
+    complete = history.since(0, out, &missing_to);
+    std::cout << "since 0: complete=" << complete << " missing_to=" << missing_to
+              << " count=" << out.size() << std::endl;                          // 0 2 4
+
+    // 远落后于最老序号时直接报告缺口，不逐条扫已淘汰的序号
+    for (int i = 7; i <= 100000; ++i)
+        history.append(std::make_shared<const std::string>("msg" + std::to_string(i)));
+    out.clear();
+    complete = history.since(1, out, &missing_to);
+    std::cout << "far behind: complete=" << complete << " missing_to=" << missing_to
+              << " count=" << out.size() << std::endl;                          // 0 99996 4
+
+    // 单条超过字节上限时只保留最新一条
+    RoomHistory small(8, 10);
+    small.append(std::make_shared<const std::string>("0123456789"));
+    small.append(std::make_shared<const std::string>("abcdefghij"));
+    std::cout << "byte bound: first=" << small.firstSeq() << " last=" << small.lastSeq() << std::endl;  // 2 2
+}
+
+// 离线日志：追加、重启恢复、投递到 socket、确认后整段回收
+void msg_log_test()
+{
+    std::string dir = "msglog_test";
+    {
+        MessageLog log(dir, 4096, 8, 10);
+        for (int i = 0; i < 100; ++i)
+            log.append(i % 2, "offline message " + std::to_string(i) + "\n");
+        std::cout << "pending uid0=" << log.pendingCount(0) << " uid1=" << log.pendingCount(1) << std::endl;   // 50 50
+    }
+
+    // 重新打开，从分段文件恢复索引
+    MessageLog log(dir, 4096, 8, 10);
+    int sv[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    uint64_t inflight = 0;
+    std::string tail;
+    int n0 = log.deliver(0, sv[0], inflight, tail);
+    int n1 = log.deliver(1, sv[0], inflight, tail);
+    char buf[64] = {0};
+    ::recv(sv[1], buf, 18, 0);
+    std::cout << "delivered " << n0 << " + " << n1 << ", first: " << buf;   // 50 + 50, offline message 0
+    std::cout << "pending after ack uid0=" << log.pendingCount(0) << std::endl;  // 0
+    // 确认文件和整段删除由后台线程做，等一个同步周期
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    int seg_files = 0;
+    if (DIR* d = opendir(dir.c_str())) {
+        while (dirent* ent = readdir(d)) seg_files += strncmp(ent->d_name, "seg_", 4) == 0;
+        closedir(d);
+    }
+    std::cout << "segment files after compaction: " << seg_files << std::endl;   // 1
+    close(sv[0]);
+    close(sv[1]);
+
+    // 收发缓冲都很小：每轮只写出一部分，被截断的记录尾部走输出缓冲，接收端拼起来必须完整有序
+    MessageLog big(dir, 1 << 20, 64, 10);
+    std::string expect;
+    for (int i = 0; i < 2000; ++i) {
+        std::string m = "record " + std::to_string(i) + " " + std::string(100 + i % 300, 'x') + "\n";
+        big.append(7, m);
+        expect += m;
+    }
+    // 本机 TCP 连接，unix socket 不会在记录中间截断
+    int lfd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t alen = sizeof(addr);
+    int small = 4096;
+    setsockopt(lfd, SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+    ::bind(lfd, (sockaddr*)&addr, sizeof(addr));
+    ::listen(lfd, 1);
+    getsockname(lfd, (sockaddr*)&addr, &alen);
+    sv[0] = ::socket(AF_INET, SOCK_STREAM, 0);
+    ::connect(sv[0], (sockaddr*)&addr, sizeof(addr));
+    sv[1] = ::accept(lfd, nullptr, nullptr);
+    close(lfd);
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+    std::string got, outbuf;
+    inflight = 0;
+    int rounds = 0, partial = 0;
+    while ((big.pendingCount(7) > 0 || !outbuf.empty()) && rounds < 100000) {
+        rounds++;
+        if (!outbuf.empty()) {
+            ssize_t w = ::send(sv[0], outbuf.data(), outbuf.size(), MSG_NOSIGNAL);
+            if (w > 0) outbuf.erase(0, w);
+        } else {
+            tail.clear();
+            big.deliver(7, sv[0], inflight, tail);
+            if (!tail.empty()) partial++;
+            outbuf += tail;
+        }
+        char rb[1024];
+        ssize_t r;
+        while ((r = ::recv(sv[1], rb, sizeof(rb), 0)) > 0) got.append(rb, r);
+    }
+    std::cout << "small sndbuf: pending=" << big.pendingCount(7) << " cut records>0=" << (partial > 0)
+              << " stream intact=" << (got == expect) << std::endl;   // 0 1 1
+    close(sv[0]);
+    close(sv[1]);
+
+    // 掉电后头在、消息体没落盘：恢复时按 CRC 截断，坏记录和之后的都不投递
+    std::string crc_dir = "msglog_crc_test";
+    if (DIR* d = opendir(crc_dir.c_str())) {
+        while (dirent* ent = readdir(d)) {
+            if (ent->d_name[0] != '.') ::unlink((crc_dir + "/" + ent->d_name).c_str());
+        }
+        closedir(d);
+    }
+    {
+        MessageLog log(crc_dir, 4096, 8, 10);
+        for (int i = 0; i < 5; ++i) log.append(3, "sixteen bytes #" + std::to_string(i));
+    }
+    if (DIR* d = opendir(crc_dir.c_str())) {
+        while (dirent* ent = readdir(d)) {
+            if (strncmp(ent->d_name, "seg_", 4) != 0) continue;
+            int fd = ::open((crc_dir + "/" + ent->d_name).c_str(), O_RDWR);
+            ::pwrite(fd, "\0\0\0\0", 4, 2 * 40 + 24);   // 第 3 条的消息体
+            ::close(fd);
+        }
+        closedir(d);
+    }
+    MessageLog torn(crc_dir, 4096, 8, 10);
+    std::cout << "after torn record: pending=" << torn.pendingCount(3) << std::endl;   // 2
+}
+
+// 用户缓存：并发未命中只查一次库，失效后重新加载
+void user_cache_test()
+{
+    std::atomic<int> db_calls{0};
+    UserCache cache(
+        [&db_calls](int id) -> UserCache::UserPtr {
+            db_calls++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            return std::make_shared<User>(id, "user" + std::to_string(id), "pwd");
+        },
+        [&db_calls](const std::string& name) -> UserCache::UserPtr {
+            db_calls++;
+            return std::make_shared<User>(std::stoi(name.substr(4)), name, "pwd");
+        },
+        4, 2);
+
+    ThreadPool pool(8);
+    pool.init();
+    std::vector<std::future<UserCache::UserPtr>> futures;
+    for (int i = 0; i < 8; ++i)
+        futures.push_back(pool.submit([&cache] { return cache.get(7); }));
+    for (auto& f : futures) f.get();
+    pool.shutdown();
+    std::cout << "8 concurrent gets -> db calls: " << db_calls << std::endl;     // 1
+
+    cache.getByName("user7");
+    std::cout << "by name after id load -> db calls: " << db_calls << std::endl; // 1
+
+    cache.invalidate(7);
+    cache.get(7);
+    std::cout << "after invalidate -> db calls: " << db_calls << std::endl;      // 2
+
+    for (int id = 100; id < 110; ++id) cache.get(id);
+    auto s = cache.stats();
+    std::cout << "hits=" << s.hits << " misses=" << s.misses << " coalesced=" << s.coalesced
+              << " evictions=" << s.evictions << std::endl;
+
+    // 按名字加载的途中改了密码并失效：不能把旧行放进缓存
+    std::atomic<int> name_loads{0};
+    UserCache pwd_cache(
+        [](int) -> UserCache::UserPtr { return nullptr; },
+        [&name_loads](const std::string& name) -> UserCache::UserPtr {
+            bool first = name_loads++ == 0;
+            if (first) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            return std::make_shared<User>(9, name, first ? "old" : "new");
+        },
+        4, 2);
+    std::thread loader([&pwd_cache] { pwd_cache.getByName("user9"); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    pwd_cache.invalidate(9);
+    loader.join();
+    auto cached = pwd_cache.peekByName("user9");
+    std::cout << "invalidate during name load -> cached password: " << (cached ? cached->password_hash : "none")
+              << ", loads: " << name_loads << std::endl;   // new, 2
+}
+
+// 密码哈希：标准向量、加盐、校验
+void password_test()
+{
+    // RFC 7914 的 PBKDF2-HMAC-SHA256 向量，P="passwd" S="salt" c=1
+    std::cout << "pbkdf2 vector: " << Password::derive("passwd", "salt", 1) << std::endl;
+    // 55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc
+
+    std::string stored = Password::make("secret");
+    std::cout << "stored prefix: " << stored.substr(0, stored.find('$', 14)) << std::endl;   // pbkdf2-sha256$10000
+    std::cout << "right=" << Password::verify("secret", stored) << " wrong=" << Password::verify("secreT", stored)
+              << " cleartext column=" << Password::verify("secret", "secret")
+              << " salted differs=" << (Password::make("secret") != stored) << std::endl;   // 1 0 0 1
+}
+
+// 会话表：槽位复用、代数校验、按房间位图扫描在线用户
+void session_table_test()
+{
+    SessionTable<int> sessions;
+    SessionRef a = sessions.open(10, std::make_shared<int>(10));
+    SessionRef b = sessions.open(11, std::make_shared<int>(11));
+    sessions.bindUser(a, 100);
+    sessions.bindUser(b, 101);
+    sessions.joinRoom(a.slot, 3);
+    sessions.joinRoom(b.slot, 3);
+    sessions.joinRoom(b.slot, 200);
+
+    std::cout << "room 3 online:";
+    for (int uid : sessions.onlineInRoom(3)) std::cout << " " << uid;   // 100 101
+    std::cout << std::endl;
+
+    sessions.close(a);
+    sessions.release(a.slot);
+    SessionRef c = sessions.open(12, std::make_shared<int>(12));
+    std::cout << "slot reused=" << (c.slot == a.slot) << " old ref alive=" << sessions.alive(a)
+              << " rooms of b=" << sessions.roomsOf(b.slot).size() << std::endl;   // 1 0 2
+
+    std::cout << "bind via stale ref: " << sessions.bindUser(a, 102) << " uid of reused slot: " << sessions.uid(c.slot)
+              << std::endl;   // 0 -1
+    std::cout << "close via stale ref: " << sessions.close(a) << " new session alive: " << sessions.alive(c)
+              << std::endl;   // 0 1
+
+    std::set<int> members = {b.slot, c.slot, 999};
+    std::cout << "conns of members: " << sessions.connsOf(members).size()
+              << " skipping b: " << sessions.connsOf(members, b.slot).size() << std::endl;   // 2 1
+}
+
+// 上下线聚合：窗口内抖动抵消，每个房间一帧
+void presence_test()
+{
+    PresenceAggregator presence;
+    presence.record(1, 10, true);
+    presence.record(1, 11, false);
+    presence.record(1, 11, true);     // 下线又上线，抵消
+    presence.record(2, 12, false);
+
+    for (auto& [room, frame] : presence.drain())
+        std::cout << "room " << room << ": " << frame;   // /presence 1 +10  /presence 2 -12
+    std::cout << "recorded=" << presence.recordedCount() << " cancelled=" << presence.cancelledCount()
+              << " frames=" << presence.frameCount() << std::endl;   // 4 1 2
+}
+
+// 文本过滤：合法性、控制字符清洗、各实现结果一致
+void text_filter_test()
+{
+    const TextKernel kernels[] = {TextKernel::Scalar, TextKernel::SSE4, TextKernel::AVX2};
+    struct Case { std::string in; TextCheck check; std::string out; };
+    std::vector<Case> cases = {
+        {"hello world, this line is long enough for a full vector\n", TextCheck::Ok, "hello world, this line is long enough for a full vector\n"},
+        {"bell\x07 and esc\x1b[31m red\r\n", TextCheck::Ok, "bell and esc[31m red\n"},
+        {"\xe4\xbd\xa0\xe5\xa5\xbd, \xe4\xb8\x96\xe7\x95\x8c", TextCheck::Ok, "\xe4\xbd\xa0\xe5\xa5\xbd, \xe4\xb8\x96\xe7\x95\x8c"},
+        {"c1 control \xc2\x85 removed", TextCheck::Ok, "c1 control  removed"},
+        {"overlong \xc0\xaf", TextCheck::BadUtf8, ""},
+        {"surrogate \xed\xa0\x80", TextCheck::BadUtf8, ""},
+        {"truncated \xe4\xbd", TextCheck::BadUtf8, ""},
+        {std::string(5000, 'a'), TextCheck::TooLong, ""},
+        {"stray x\x80 continuation byte in the middle of a long line", TextCheck::BadUtf8, ""},
+    };
+    int failed = 0;
+    for (auto k : kernels) {
+        for (auto& c : cases) {
+            std::string s = c.in;
+            TextCheck r = TextFilter::scrub(s, MAX_MSG_BYTES, false, k);
+            if (r != c.check || (r == TextCheck::Ok && s != c.out)) failed++;
+        }
+    }
+    // 拒绝控制字符模式：非法字节前面停在可打印字符上，不能误报成控制字符
+    for (auto k : kernels) {
+        std::string s = "stray x\x80 continuation byte in the middle of a long line";
+        if (TextFilter::scrub(s, MAX_MSG_BYTES, true, k) != TextCheck::BadUtf8) failed++;
+        s = "bell\x07 rejected";
+        if (TextFilter::scrub(s, MAX_MSG_BYTES, true, k) != TextCheck::Control) failed++;
+    }
+    std::cout << "text filter cases failed: " << failed << std::endl;   // 0
+
+    // 随机拼接合法字符、控制字符和非法字节，三种实现的结果必须完全一致，删除和拒绝控制字符两种模式都比
+    const char* pieces[] = {"a", "hello ", "\n", "\t", "\x01", "\x7f", "\xc2\x85", "\xc2\xa9", "\xe4\xbd\xa0",
+                            "\xf0\x9f\x98\x80", "\xed\xa0\x80", "\xc0\xaf", "\x80", "\xe4\xbd", "\xf4\x90\x80\x80"};
+    std::mt19937 gen(42);
+    int mismatched = 0;
+    for (int round = 0; round < 20000; ++round) {
+        std::string in;
+        int len = gen() % 60;
+        bool rare = gen() % 4 == 0;     // 大部分输入只用合法字符，才能走到长的向量段
+        for (int k = 0; k < len; ++k) in += pieces[rare ? gen() % 15 : (gen() % 10 == 0 ? 6 + gen() % 4 : gen() % 2 * 8 + gen() % 2)];
+        for (bool reject : {false, true}) {
+            std::string ref = in;
+            TextCheck rr = TextFilter::scrub(ref, MAX_MSG_BYTES, reject, TextKernel::Scalar);
+            for (auto k : {TextKernel::SSE4, TextKernel::AVX2}) {
+                std::string t = in;
+                TextCheck r = TextFilter::scrub(t, MAX_MSG_BYTES, reject, k);
+                if (r != rr || (r == TextCheck::Ok && t != ref)) mismatched++;
+            }
+        }
+    }
+    std::cout << "random inputs where kernels disagree: " << mismatched << std::endl;   // 0
+
+    // 按字节流切开的多字节字符：末尾半截留到下一次，拼上后整条合法
+    std::string cjk;
+    while (cjk.size() < 2000) cjk += "\xe4\xbd\xa0\xe5\xa5\xbd";
+    std::string first = cjk.substr(0, 1024);
+    std::size_t keep = TextFilter::incompleteTail(first);
+    std::string carried = first.substr(first.size() - keep) + cjk.substr(1024);
+    first.resize(first.size() - keep);
+    std::cout << "split cjk: kept " << keep << ", parts ok "
+              << (TextFilter::scrub(first, MAX_MSG_BYTES) == TextCheck::Ok &&
+                  TextFilter::scrub(carried, MAX_MSG_BYTES) == TextCheck::Ok)
+              << ", bad tail kept " << TextFilter::incompleteTail("x\xc0\xaf") << std::endl;   // 1, 1, 0
+}
+
+// 文本过滤性能：标量 vs SSE4.1 vs AVX2，分别测大部分 ASCII 的消息和纯中文消息
+void text_filter_bench()
+{
+    std::string ascii, cjk;
+    while (ascii.size() < 480)
+        ascii += "the quick brown fox jumps over the lazy dog 0123456789 \xe4\xbd\xa0\xe5\xa5\xbd ";
+    ascii += "\n";
+    while (cjk.size() < 480)
+        cjk += "\xe4\xbd\xa0\xe5\xa5\xbd\xef\xbc\x8c\xe4\xb8\x96\xe7\x95\x8c\xe3\x80\x82";
+    cjk += "\n";
+    const int rounds = 200000;
+    const TextKernel kernels[] = {TextKernel::Scalar, TextKernel::SSE4, TextKernel::AVX2};
+    for (const std::string* msg : {&ascii, &cjk}) {
+        const char* label = msg == &ascii ? "ascii" : "cjk";
+        for (auto k : kernels) {
+            std::size_t total = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < rounds; ++i) {
+                std::string s = *msg;
+                TextFilter::scrub(s, MAX_MSG_BYTES, false, k);
+                total += s.size();
+            }
+            double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout << label << " " << TextFilter::kernelName(k) << ": " << total / sec / (1 << 20) << " MB/s" << std::endl;
+        }
+    }
+}
+
+// 三个节点跑在本机不同端口：房间 5 只在节点 1、2 有成员，节点 2 发的消息只到节点 1，且只到一次
+void cluster_test()
+{
+    std::vector<ClusterPeer> peers = {{1, "127.0.0.1", 9701}, {2, "127.0.0.1", 9702}, {3, "127.0.0.1", 9703}};
+    std::mutex mu;
+    std::vector<std::pair<int, std::string>> received[4];
+    std::vector<std::unique_ptr<ClusterNode>> nodes;
+    for (auto& p : peers) {
+        nodes.push_back(std::make_unique<ClusterNode>(p.id, p.port, peers));
+        int id = p.id;
+        nodes.back()->setMessageHandler([&mu, &received, id](int room, const std::string& body) {
+            std::lock_guard<std::mutex> lock(mu);
+            received[id].emplace_back(room, body);
+        });
+        nodes.back()->start();
+    }
+    std::cout << "room 5 home node: " << nodes[0]->homeOf(5)
+              << ", agreed: " << (nodes[1]->homeOf(5) == nodes[0]->homeOf(5) && nodes[2]->homeOf(5) == nodes[0]->homeOf(5))
+              << std::endl;   // 2, 1
+
+    nodes[0]->subscribe(5);
+    nodes[1]->subscribe(5);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::cout << "node 2 sees interest in room 5: " << nodes[1]->interestedNodes(5).size() << std::endl;   // 2
+
+    int sent = nodes[1]->publish(5, "User 7: hello");
+    nodes[2]->publish(6, "User 8: nobody here");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    {
+        std::lock_guard<std::mutex> lock(mu);
+        std::cout << "sent: " << sent << ", node 1: " << received[1].size() << ", node 2: " << received[2].size()
+                  << ", node 3: " << received[3].size() << std::endl;   // 1, 1, 0, 0
+        if (!received[1].empty()) std::cout << received[1][0].first << " " << received[1][0].second << std::endl;
+    }
+
+    nodes[0]->unsubscribe(5);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::cout << "after unsubscribe, node 2 forwards to: " << nodes[1]->publish(5, "User 7: anyone?") << std::endl;   // 0
+    for (auto& n : nodes) n->stop();
+}
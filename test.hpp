@@ -1 +1,11 @@
-void thread_pool_test();
\ No newline at end of file
+void thread_pool_test();
+void thread_pool_lane_test();
+void room_history_test();
+void msg_log_test();
+void user_cache_test();
+void password_test();
+void session_table_test();
+void presence_test();
+void text_filter_test();
+void text_filter_bench();
+void cluster_test();
\ No newline at end of file
@@ -9,7 +9,13 @@
 #include <atomic>
 #include <future>
 #include <memory>
+#include <list>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <unordered_map>
 #include "debug_logger.hpp"   // 日志类
+#include "affinity.hpp"
 #include "define.hpp"
 
 template <typename T>
@@ -41,14 +47,18 @@ public:
         return (int)s_queue.size();
     }
 
+    // 入队并返回入队后的长度
     template <typename U>
-    void enqueue(U&& t) {
+    int enqueue(U&& t) {
+        int n;
         {
             std::lock_guard<std::mutex> lock(s_mu);
             s_queue.emplace(std::forward<U>(t));
-            LOG_DEBUG("Task enqueued, queue size=", s_queue.size());
+            n = (int)s_queue.size();
+            LOG_DEBUG("Task enqueued, queue size=", n);
         }
         s_cv.notify_one();
+        return n;
     }
 
     bool dequeue(T& t, bool wait = false, bool is_shutdown = false) {
@@ -78,54 +88,140 @@ public:
             return true;
         }
     }
+
+    // 带超时的阻塞出队，stop 是引用，shutdown 时能真正唤醒等待者
+    // 队列非空时总会出队成功，所以 shutdown 之后还会把剩余任务跑完
+    bool dequeue_for(T& t, const std::atomic<bool>& stop, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(s_mu);
+        s_cv.wait_for(lock, timeout, [this, &stop] { return stop.load() || !s_queue.empty(); });
+        if (s_queue.empty()) {
+            return false;
+        }
+        t = std::move(s_queue.front());
+        s_queue.pop();
+        LOG_DEBUG("Task dequeued (timed), queue size=", s_queue.size());
+        return true;
+    }
 };
 
 class ThreadPool {
 public:
+    // 执行通道：每个通道有独立的队列和工作线程，
+    // 阻塞型任务（db）再多也不会占住网络分发（net）的线程
+    struct Lane {
+        std::string name;
+        int core_workers;
+        int max_workers;     // > core_workers 时开启弹性扩容
+        std::vector<int> cpus;   // 为空表示不绑核，否则第 i 个线程绑 cpus[i % n]
+        SafeQueue<std::function<void()>> queue;
+
+        std::vector<std::thread> core_threads;
+        // 弹性线程空闲超时后自行退出，done 用于回收
+        struct ElasticThread {
+            std::thread t;
+            std::shared_ptr<std::atomic<bool>> done;
+        };
+        std::list<ElasticThread> elastic_threads;
+        int elastic_spawned = 0;
+        std::mutex threads_mu;
+
+        std::atomic<int> live{0};
+        std::atomic<int> idle{0};
+        std::atomic<int> max_queued{0};
+        std::atomic<uint64_t> submitted{0};
+        std::atomic<uint64_t> completed{0};
+        std::atomic<uint64_t> wait_us{0};   // 任务在队列里等待的累计时间
+
+        Lane(const std::string& n, int core, int max)
+            : name(n), core_workers(core), max_workers(max < core ? core : max) {}
+    };
+
+    // 单个通道的统计快照
+    struct LaneStats {
+        std::string name;
+        int workers;
+        int idle;
+        int queued;
+        int max_queued;
+        uint64_t submitted;
+        uint64_t completed;
+        uint64_t avg_wait_us;
+        std::string cpus;
+    };
+
     // 内部线程工作类
     class ThreadWorker {
     private:
         int w_id;
         ThreadPool* w_pool;
+        Lane* w_lane;
+        bool w_elastic;
+        std::shared_ptr<std::atomic<bool>> w_done;
     public:
-        ThreadWorker(ThreadPool* pool, const int id) : w_id(id), w_pool(pool) {
-            LOG_DEBUG("ThreadWorker ", id, " created");
+        ThreadWorker(ThreadPool* pool, Lane* lane, const int id,
+                     std::shared_ptr<std::atomic<bool>> done = nullptr)
+            : w_id(id), w_pool(pool), w_lane(lane), w_elastic(done != nullptr), w_done(std::move(done)) {
+            LOG_DEBUG("ThreadWorker ", lane->name, "/", id, " created");
         }
 
         void operator()() {
-            LOG_DEBUG("Worker ", w_id, " started");
+            // 先绑核再干活，栈和线程私有缓冲区才会落在本地节点
+            if (!w_lane->cpus.empty()) {
+                int cpu = w_lane->cpus[w_id % w_lane->cpus.size()];
+                if (Affinity::pinCurrentThread(cpu)) {
+                    LOG_INFO("Worker ", w_lane->name, "/", w_id, " pinned to cpu ", cpu,
+                             " node ", Affinity::cpuNode(cpu));
+                }
+            } else {
+                // 创建者（比如绑了核的 epoll 线程）的绑核会被继承，不绑核的通道要还原
+                Affinity::unpinCurrentThread();
+            }
+            LOG_DEBUG("Worker ", w_lane->name, "/", w_id, " started");
             std::function<void()> func;
-            bool dequeued;
+            auto timeout = std::chrono::milliseconds(LANE_IDLE_MS);
 
-            while (!w_pool->is_shutdown) {
-                dequeued = w_pool->task_queue.dequeue(func, true, w_pool->is_shutdown);
+            while (true) {
+                w_lane->idle++;
+                bool dequeued = w_lane->queue.dequeue_for(func, w_pool->is_shutdown, timeout);
+                w_lane->idle--;
 
                 if (!dequeued) {
-                    LOG_DEBUG("Worker ", w_id, " exiting loop");
-                    break;
+                    // 核心线程只在 shutdown 且队列清空后退出，弹性线程空闲超时即退出
+                    if (w_pool->is_shutdown || w_elastic) {
+                        LOG_DEBUG("Worker ", w_lane->name, "/", w_id, " exiting loop");
+                        break;
+                    }
+                    continue;
                 }
 
-                LOG_DEBUG("Worker ", w_id, " executing task");
+                LOG_DEBUG("Worker ", w_lane->name, "/", w_id, " executing task");
                 try {
                     func();
-                    LOG_DEBUG("Worker ", w_id, " finished task");
+                    LOG_DEBUG("Worker ", w_lane->name, "/", w_id, " finished task");
                 } catch (const std::exception& e) {
-                    LOG_ERROR("Worker ", w_id, " task threw exception: ", e.what());
+                    LOG_ERROR("Worker ", w_lane->name, "/", w_id, " task threw exception: ", e.what());
                 } catch (...) {
-                    LOG_ERROR("Worker ", w_id, " task threw unknown exception");
+                    LOG_ERROR("Worker ", w_lane->name, "/", w_id, " task threw unknown exception");
                 }
+                w_lane->completed++;
             }
 
-            LOG_DEBUG("Worker ", w_id, " stopped");
+            w_lane->live--;
+            if (w_done) *w_done = true;
+            LOG_DEBUG("Worker ", w_lane->name, "/", w_id, " stopped");
         }
     };
 
     std::atomic<bool> is_shutdown{false};
-    SafeQueue<std::function<void()>> task_queue;
-    std::vector<std::thread> work_thread;
-
-    ThreadPool(const int num_workers = NUM_WORKERS)
-        : is_shutdown(false), work_thread(std::vector<std::thread>(num_workers)) {
+    bool is_started = false;
+    std::vector<std::unique_ptr<Lane>> lanes;
+    std::unordered_map<std::string, Lane*> lane_index;
+    std::string default_lane;
+
+    ThreadPool(const int num_workers = NUM_WORKERS, const std::string& default_lane_name = DEFAULT_LANE)
+        : is_shutdown(false), default_lane(default_lane_name) {
+        addLane(default_lane_name, num_workers);
+        Affinity::processMask();    // 趁还没有线程绑核，记下进程原本的 cpu 集合
         LOG_INFO("ThreadPool created with ", num_workers, " workers");
     }
 
@@ -134,50 +230,183 @@ public:
     ThreadPool& operator=(const ThreadPool&) = delete;
     ThreadPool& operator=(ThreadPool&&) = delete;
 
+    // 增加通道，必须在 init() 之前调用
+    // max_workers > workers 时，该通道在所有线程都忙且有积压时临时扩容
+    bool addLane(const std::string& name, int workers, int max_workers = 0) {
+        if (is_started) {
+            LOG_ERROR("ThreadPool addLane ", name, " after init");
+            return false;
+        }
+        if (lane_index.count(name)) {
+            LOG_ERROR("ThreadPool lane ", name, " already exists");
+            return false;
+        }
+        lanes.emplace_back(std::make_unique<Lane>(name, workers, max_workers));
+        lane_index[name] = lanes.back().get();
+        LOG_INFO("ThreadPool lane ", name, " added, workers=", workers, " max=", lanes.back()->max_workers);
+        return true;
+    }
+
+    // 设置通道的绑核集合，必须在 init() 之前调用
+    // 同一通道的线程共享一个队列，跨 NUMA 节点时队列总有一半访问是远端的
+    bool setLaneCpus(const std::string& name, const std::vector<int>& cpus) {
+        if (is_started) {
+            LOG_ERROR("ThreadPool setLaneCpus ", name, " after init");
+            return false;
+        }
+        Lane& lane = getLane(name);
+        lane.cpus = cpus;
+        auto nodes = Affinity::cpuNodes(cpus);
+        if (nodes.size() > 1) {
+            LOG_WARN("Lane ", name, " cpus ", Affinity::toCpuList(cpus), " span ", nodes.size(), " numa nodes");
+        }
+        LOG_INFO("Lane ", name, " cpus=", Affinity::toCpuList(cpus));
+        return true;
+    }
+
     void init() {
-        for (std::size_t i = 0; i < work_thread.size(); i++) {
-            work_thread[i] = std::thread(ThreadWorker(this, (int)i));
-            LOG_INFO("Thread ", i, " started");
+        is_started = true;
+        for (auto& lane : lanes) {
+            for (int i = 0; i < lane->core_workers; i++) {
+                lane->live++;
+                lane->core_threads.emplace_back(ThreadWorker(this, lane.get(), i));
+                LOG_INFO("Thread ", lane->name, "/", i, " started");
+            }
         }
     }
 
     void shutdown() {
         LOG_WARN("ThreadPool shutting down");
         is_shutdown = true;
-        {
-            std::unique_lock<std::mutex> lock(task_queue.s_mu);
-            task_queue.s_cv.notify_all();
+        for (auto& lane : lanes) {
+            std::unique_lock<std::mutex> lock(lane->queue.s_mu);
+            lane->queue.s_cv.notify_all();
         }
-        for (std::size_t i = 0; i < work_thread.size(); i++) {
-            if (work_thread[i].joinable()) {
-                work_thread[i].join();
-                LOG_INFO("Thread ", i, " joined");
+        for (auto& lane : lanes) {
+            for (std::size_t i = 0; i < lane->core_threads.size(); i++) {
+                if (lane->core_threads[i].joinable()) {
+                    lane->core_threads[i].join();
+                    LOG_INFO("Thread ", lane->name, "/", i, " joined");
+                }
+            }
+            std::lock_guard<std::mutex> lock(lane->threads_mu);
+            for (auto& et : lane->elastic_threads) {
+                if (et.t.joinable()) et.t.join();
             }
+            lane->elastic_threads.clear();
         }
         LOG_INFO("ThreadPool shutdown complete");
     }
 
-    // 提交任务
+    std::vector<LaneStats> stats() {
+        std::vector<LaneStats> out;
+        for (auto& lane : lanes) {
+            uint64_t done = lane->completed;
+            out.push_back(LaneStats{
+                lane->name,
+                lane->live.load(),
+                lane->idle.load(),
+                lane->queue.size(),
+                lane->max_queued.load(),
+                lane->submitted.load(),
+                done,
+                done ? lane->wait_us.load() / done : 0,
+                Affinity::toCpuList(lane->cpus),
+            });
+        }
+        return out;
+    }
+
+    void logStats() {
+        for (auto& s : stats()) {
+            LOG_INFO("Lane ", s.name, " workers=", s.workers, " idle=", s.idle,
+                     " queued=", s.queued, " max_queued=", s.max_queued,
+                     " submitted=", s.submitted, " completed=", s.completed,
+                     " avg_wait_us=", s.avg_wait_us,
+                     " cpus=", s.cpus.empty() ? "any" : s.cpus);
+        }
+    }
+
+    // 提交任务到默认通道
     template <typename F, typename... Args>
     auto submit(F&& f, Args&&... args) -> std::future<decltype(f(args...))> {
+        return submit(default_lane, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    // 提交任务到指定通道
+    template <typename F, typename... Args>
+    auto submit(const std::string& lane_name, F&& f, Args&&... args) -> std::future<decltype(f(args...))> {
         using RetType = decltype(f(args...));
 
+        Lane& lane = getLane(lane_name);
+
         std::function<RetType()> func = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
 
         auto task_ptr = std::make_shared<std::packaged_task<RetType()>>(func);
 
-        std::function<void()> wrapper_func = [task_ptr]() {
+        auto enqueued_at = std::chrono::steady_clock::now();
+        Lane* lp = &lane;
+        std::function<void()> wrapper_func = [task_ptr, enqueued_at, lp]() {
+            auto waited = std::chrono::steady_clock::now() - enqueued_at;
+            lp->wait_us += std::chrono::duration_cast<std::chrono::microseconds>(waited).count();
             (*task_ptr)();
         };
-        task_queue.enqueue(wrapper_func);
+        lane.submitted++;
+        int depth = lane.queue.enqueue(wrapper_func);
+
+        int prev = lane.max_queued;
+        while (depth > prev && !lane.max_queued.compare_exchange_weak(prev, depth)) {}
 
-        LOG_DEBUG("Task submitted",f,args...);
+        maybeGrow(lane);
+
+        LOG_DEBUG("Task submitted to lane ", lane_name, f, args...);
 
         return task_ptr->get_future();
     }
+
+private:
+    Lane& getLane(const std::string& name) {
+        auto it = lane_index.find(name);
+        if (it == lane_index.end()) {
+            LOG_ERROR("ThreadPool unknown lane ", name);
+            throw std::runtime_error("unknown lane: " + name);
+        }
+        return *it->second;
+    }
+
+    // 所有线程都在忙且有积压时，弹性通道临时加一个线程
+    void maybeGrow(Lane& lane) {
+        if (lane.max_workers <= lane.core_workers || is_shutdown || !is_started) return;
+        if (lane.idle > 0 || lane.queue.empty()) return;
+
+        int cur = lane.live;
+        do {
+            if (cur >= lane.max_workers) return;
+        } while (!lane.live.compare_exchange_weak(cur, cur + 1));
+
+        std::lock_guard<std::mutex> lock(lane.threads_mu);
+        if (is_shutdown) {
+            lane.live--;
+            return;
+        }
+        // 顺手回收已经退出的弹性线程
+        for (auto it = lane.elastic_threads.begin(); it != lane.elastic_threads.end();) {
+            if (*it->done) {
+                it->t.join();
+                it = lane.elastic_threads.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        auto done = std::make_shared<std::atomic<bool>>(false);
+        int id = lane.core_workers + lane.elastic_spawned++;
+        lane.elastic_threads.push_back({std::thread(ThreadWorker(this, &lane, id, done)), done});
+        LOG_INFO("Lane ", lane.name, " grew to ", cur + 1, " workers");
+    }
 };
 
 
+
 // // 任务队列
 // template <typename T>
 // class SafeQueue{